@@ -14,5 +14,36 @@ static const Steinberg::FUID kFFTPitchShiftControllerUID (0x3E43BE61, 0x456A53F9
 
 #define FFTPitchShiftVST3Category "Fx"
 
+//------------------------------------------------------------------------
+enum FFTPitchShiftParams : Steinberg::Vst::ParamID
+{
+	kPitchId = 0,
+	kEngineId,
+	kGovernorId,
+	kCorrectionId,
+	kKeyId,
+	kScaleId,
+	kRetuneId,
+	kStereoLinkId,
+
+	// read-only, sent by the processor while the governor is on
+	kGovernorLevelId,
+	kCpuLoadId,
+
+	// read-only, latency in samples / kMaxReportedLatency the parameters need,
+	// sent by the processor so the controller restarts after it has them
+	kLatencyId,
+};
+
+static const Steinberg::int32 kMaxReportedLatency = 1 << 16;
+
+enum FFTPitchShiftEngines : Steinberg::int32
+{
+	kEngineSpectral = 0,
+	kEngineTimeDomain,
+	kEngineMultiRes,
+	kNumEngines
+};
+
 //------------------------------------------------------------------------
 } // namespace tobyCorp
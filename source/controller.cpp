@@ -5,6 +5,7 @@
 #include "controller.h"
 #include "cids.h"
 #include "vstgui/plugin-bindings/vst3editor.h"
+#include "base/source/fstreamer.h"
 
 using namespace Steinberg;
 
@@ -25,7 +26,54 @@ tresult PLUGIN_API FFTPitchShiftController::initialize (FUnknown* context)
 	}
 
 	// Here you could register some parameters
-    parameters.addParameter(STR16("pitch"),nullptr, 0, 0.5, Vst::ParameterInfo::kCanAutomate,0);
+    parameters.addParameter(STR16("pitch"),nullptr, 0, 0.5, Vst::ParameterInfo::kCanAutomate,kPitchId);
+
+    auto* engineParam = new Vst::StringListParameter (STR16 ("engine"), kEngineId, nullptr,
+        Vst::ParameterInfo::kCanAutomate | Vst::ParameterInfo::kIsList);
+    engineParam->appendString (STR16 ("Spectral"));
+    engineParam->appendString (STR16 ("Time Domain"));
+    engineParam->appendString (STR16 ("Multi-Resolution"));
+    parameters.addParameter (engineParam);
+
+    parameters.addParameter (STR16 ("governor"), nullptr, 1, 0, Vst::ParameterInfo::kCanAutomate, kGovernorId);
+
+    auto* levelParam = new Vst::StringListParameter (STR16 ("quality level"), kGovernorLevelId, nullptr,
+        Vst::ParameterInfo::kIsReadOnly | Vst::ParameterInfo::kIsList);
+    levelParam->appendString (STR16 ("Full"));
+    levelParam->appendString (STR16 ("Half Overlap"));
+    levelParam->appendString (STR16 ("Small FFT"));
+    levelParam->appendString (STR16 ("Time Domain"));
+    parameters.addParameter (levelParam);
+
+    parameters.addParameter (STR16 ("cpu load"), nullptr, 0, 0, Vst::ParameterInfo::kIsReadOnly, kCpuLoadId);
+    parameters.addParameter (STR16 ("latency"), nullptr, 0, 0, Vst::ParameterInfo::kIsReadOnly | Vst::ParameterInfo::kIsHidden,
+        kLatencyId);
+
+    auto* correctionParam = new Vst::StringListParameter (STR16 ("correction"), kCorrectionId, nullptr,
+        Vst::ParameterInfo::kCanAutomate | Vst::ParameterInfo::kIsList);
+    correctionParam->appendString (STR16 ("Off"));
+    correctionParam->appendString (STR16 ("Scale"));
+    correctionParam->appendString (STR16 ("MIDI"));
+    parameters.addParameter (correctionParam);
+
+    auto* keyParam = new Vst::StringListParameter (STR16 ("key"), kKeyId, nullptr,
+        Vst::ParameterInfo::kCanAutomate | Vst::ParameterInfo::kIsList);
+    const Vst::TChar* keyNames[] = {STR16 ("C"), STR16 ("C#"), STR16 ("D"), STR16 ("D#"), STR16 ("E"), STR16 ("F"),
+                                    STR16 ("F#"), STR16 ("G"), STR16 ("G#"), STR16 ("A"), STR16 ("A#"), STR16 ("B")};
+    for (auto* keyName : keyNames)
+        keyParam->appendString (keyName);
+    parameters.addParameter (keyParam);
+
+    auto* scaleParam = new Vst::StringListParameter (STR16 ("scale"), kScaleId, nullptr,
+        Vst::ParameterInfo::kCanAutomate | Vst::ParameterInfo::kIsList);
+    scaleParam->appendString (STR16 ("Chromatic"));
+    scaleParam->appendString (STR16 ("Major"));
+    scaleParam->appendString (STR16 ("Minor"));
+    parameters.addParameter (scaleParam);
+
+    parameters.addParameter (STR16 ("retune"), nullptr, 0, 0.1, Vst::ParameterInfo::kCanAutomate, kRetuneId);
+
+    parameters.addParameter (STR16 ("stereo link"), nullptr, 1, 0, Vst::ParameterInfo::kCanAutomate, kStereoLinkId);
     
 	return result;
 }
@@ -46,6 +94,41 @@ tresult PLUGIN_API FFTPitchShiftController::setComponentState (IBStream* state)
 	if (!state)
 		return kResultFalse;
 
+	IBStreamer streamer (state, kLittleEndian);
+
+	// the processor reports the latency the loaded state needs through kLatencyId
+	float savedPitch = 0.f;
+	if (streamer.readFloat (savedPitch))
+		EditControllerEx1::setParamNormalized (kPitchId, savedPitch);
+
+	int32 savedEngine = 0;
+	if (streamer.readInt32 (savedEngine))
+		EditControllerEx1::setParamNormalized (kEngineId, plainParamToNormalized (kEngineId, savedEngine));
+
+	int32 savedGovernor = 0;
+	if (streamer.readInt32 (savedGovernor))
+		EditControllerEx1::setParamNormalized (kGovernorId, savedGovernor ? 1. : 0.);
+
+	int32 savedMode = 0;
+	if (streamer.readInt32 (savedMode))
+		EditControllerEx1::setParamNormalized (kCorrectionId, plainParamToNormalized (kCorrectionId, savedMode));
+
+	int32 savedKey = 0;
+	if (streamer.readInt32 (savedKey))
+		EditControllerEx1::setParamNormalized (kKeyId, plainParamToNormalized (kKeyId, savedKey));
+
+	int32 savedScale = 0;
+	if (streamer.readInt32 (savedScale))
+		EditControllerEx1::setParamNormalized (kScaleId, plainParamToNormalized (kScaleId, savedScale));
+
+	float savedRetune = 0.f;
+	if (streamer.readFloat (savedRetune))
+		EditControllerEx1::setParamNormalized (kRetuneId, savedRetune);
+
+	int32 savedLink = 0;
+	if (streamer.readInt32 (savedLink))
+		EditControllerEx1::setParamNormalized (kStereoLinkId, savedLink ? 1. : 0.);
+
 	return kResultOk;
 }
 
@@ -66,6 +149,23 @@ tresult PLUGIN_API FFTPitchShiftController::getState (IBStream* state)
 	return kResultTrue;
 }
 
+//------------------------------------------------------------------------
+tresult PLUGIN_API FFTPitchShiftController::setParamNormalized (Vst::ParamID tag, Vst::ParamValue value)
+{
+	// each engine has its own latency and the governor pads all of them to the longest one.
+	// The processor reports the latency once it has the new parameters, the first report
+	// after loading is the one the host already has
+	Vst::ParamValue previous = getParamNormalized (tag);
+	bool latencyChanged = tag == kLatencyId && previous != 0 && value != previous;
+
+	tresult result = EditControllerEx1::setParamNormalized (tag, value);
+
+	if (latencyChanged && componentHandler)
+		componentHandler->restartComponent (Vst::kLatencyChanged);
+
+	return result;
+}
+
 //------------------------------------------------------------------------
 IPlugView* PLUGIN_API FFTPitchShiftController::createView (FIDString name)
 {
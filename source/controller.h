@@ -33,6 +33,8 @@ public:
 	Steinberg::IPlugView* PLUGIN_API createView (Steinberg::FIDString name) SMTG_OVERRIDE;
 	Steinberg::tresult PLUGIN_API setState (Steinberg::IBStream* state) SMTG_OVERRIDE;
 	Steinberg::tresult PLUGIN_API getState (Steinberg::IBStream* state) SMTG_OVERRIDE;
+	Steinberg::tresult PLUGIN_API setParamNormalized (Steinberg::Vst::ParamID tag,
+	                                                  Steinberg::Vst::ParamValue value) SMTG_OVERRIDE;
 
  	//---Interface---------
 	DEFINE_INTERFACES
@@ -0,0 +1,62 @@
+//------------------------------------------------------------------------
+// Copyright(c) 2024 Toby Corp.
+//------------------------------------------------------------------------
+
+#include "cpugovernor.h"
+
+namespace tobyCorp {
+
+//------------------------------------------------------------------------
+// CpuGovernor
+//------------------------------------------------------------------------
+void CpuGovernor::prepare(int numLevels, double sampleRate)
+{
+    NumLevels = numLevels > 0 ? numLevels : 1;
+    SampleRate = sampleRate;
+    reset();
+}
+
+//------------------------------------------------------------------------
+void CpuGovernor::reset()
+{
+    Level = 0;
+    Load = 0;
+    SinceChange = 0;
+    LowLoadTime = 0;
+}
+
+//------------------------------------------------------------------------
+int CpuGovernor::update(double seconds, int numSamples)
+{
+    if (numSamples <= 0)
+        return Level;
+
+    double budget = (double)numSamples / SampleRate;
+    float load = (float)(seconds / budget);
+
+    // one pole smoothing with a time constant of about 100ms
+    float coeff = (float)(budget / (budget + 0.1));
+    Load += coeff * (load - Load);
+
+    SinceChange += budget;
+    LowLoadTime = Load < kStepUpLoad ? LowLoadTime + budget : 0;
+
+    // give the new level time to show its real cost before judging it
+    if (SinceChange < kSettleTime)
+        return Level;
+
+    if (load > kStepDownLoad && Level < NumLevels - 1)
+    {
+        Level++;
+        SinceChange = LowLoadTime = 0;
+    }
+    else if (LowLoadTime > kRecoverTime && Level > 0)
+    {
+        Level--;
+        SinceChange = LowLoadTime = 0;
+    }
+    return Level;
+}
+
+//------------------------------------------------------------------------
+} // namespace tobyCorp
@@ -0,0 +1,48 @@
+//------------------------------------------------------------------------
+// Copyright(c) 2024 Toby Corp.
+//------------------------------------------------------------------------
+
+#pragma once
+
+namespace tobyCorp {
+
+//------------------------------------------------------------------------
+//  CpuGovernor
+//
+//  Compares the time spent in each callback with the real-time budget of
+//  the block and picks a quality level, 0 being the best one. A callback
+//  close to its deadline steps one level down right away; the level only
+//  steps back up after the load stayed low for a while, which keeps it
+//  from bouncing between two levels.
+//------------------------------------------------------------------------
+class CpuGovernor
+{
+public:
+    void prepare(int numLevels, double sampleRate);
+    void reset();
+
+    /** Feeds back the time one callback took, returns the level to run next. */
+    int update(double seconds, int numSamples);
+    int getLevel() const { return Level; }
+    /** Smoothed share of the block's real-time budget, 1 is a dropout. */
+    float getLoad() const { return Load; }
+
+    // fraction of the budget a single callback may use before stepping down
+    static constexpr float kStepDownLoad = 0.6f;
+    // smoothed load under which the next level up would still fit
+    static constexpr float kStepUpLoad = 0.2f;
+    // seconds to wait after a change, and of low load before stepping up
+    static constexpr double kSettleTime = 0.25;
+    static constexpr double kRecoverTime = 2.0;
+
+protected:
+    int NumLevels = 1;
+    int Level = 0;
+    double SampleRate = 44100;
+    float Load = 0;
+    double SinceChange = 0;  // seconds since the last level change
+    double LowLoadTime = 0;  // seconds the load has been under kStepUpLoad
+};
+
+//------------------------------------------------------------------------
+} // namespace tobyCorp
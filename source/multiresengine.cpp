@@ -0,0 +1,181 @@
+//------------------------------------------------------------------------
+// Copyright(c) 2024 Toby Corp.
+//------------------------------------------------------------------------
+
+#include "multiresengine.h"
+#include <algorithm>
+#include <math.h>
+
+namespace tobyCorp {
+
+//------------------------------------------------------------------------
+// MultiResEngine
+//------------------------------------------------------------------------
+void MultiResEngine::prepare(double sampleRate, int numChannels, bool spreadLoad, int minLatency,
+                             float crossoverHz, float cutoffHz)
+{
+    NumChannels = std::min(std::max(numChannels, 1), (int)kMaxChannels);
+
+    // the high band is delayed to the low band's latency
+    Low.prepare(kLowFFTSize, kOverlap, NumChannels, spreadLoad, minLatency);
+    High.prepare(kHighFFTSize, kOverlap, NumChannels, spreadLoad, Low.getLatencySamples());
+
+    // both bands are 48dB down two octaves past the crossover, that is where they stop
+    float binHz = (float)sampleRate / (float)kLowFFTSize;
+    Low.setBinRange(0, (int)ceilf(4.f * crossoverHz / binHz) + 1);
+    binHz = (float)sampleRate / (float)kHighFFTSize;
+    High.setBinRange((int)(0.25f * crossoverHz / binHz), kHighFFTSize / 2);
+    High.setSkipQuietBins((int)(cutoffHz / binHz), kSkipFloor);
+    Low.setSkipQuietBins((int)(cutoffHz * (float)kLowFFTSize / (float)sampleRate), kSkipFloor);
+
+    // Butterworth sections from the RBJ cookbook, Q = 1/sqrt(2)
+    float w0 = 2.f * M_PI * std::min(crossoverHz, 0.45f * (float)sampleRate) / (float)sampleRate;
+    float alpha = sinf(w0) / (2.f * (float)M_SQRT1_2);
+    float a0 = 1.f + alpha;
+    Biquad lowPass, highPass;
+    lowPass.B0 = lowPass.B2 = (1.f - cosf(w0)) / 2.f / a0;
+    lowPass.B1 = (1.f - cosf(w0)) / a0;
+    highPass.B0 = highPass.B2 = (1.f + cosf(w0)) / 2.f / a0;
+    highPass.B1 = -(1.f + cosf(w0)) / a0;
+    lowPass.A1 = highPass.A1 = -2.f * cosf(w0) / a0;
+    lowPass.A2 = highPass.A2 = (1.f - alpha) / a0;
+
+    for (int ch = 0; ch < kMaxChannels; ch++)
+    {
+        LowPass[ch][0] = LowPass[ch][1] = lowPass;
+        HighPass[ch][0] = HighPass[ch][1] = highPass;
+        LowBuffer[ch].resize(kChunkSize);
+        HighBuffer[ch].resize(kChunkSize);
+    }
+    reset();
+}
+
+//------------------------------------------------------------------------
+void MultiResEngine::setPhaseLock(bool state)
+{
+    Low.setPhaseLock(state);
+    High.setPhaseLock(state);
+}
+
+//------------------------------------------------------------------------
+void MultiResEngine::setMultiThreaded(bool state)
+{
+    Low.setMultiThreaded(state);
+    High.setMultiThreaded(state);
+}
+
+//------------------------------------------------------------------------
+void MultiResEngine::setStereoLink(bool state)
+{
+    Low.setStereoLink(state);
+    High.setStereoLink(state);
+}
+
+//------------------------------------------------------------------------
+void MultiResEngine::setPitchCorrector(PitchCorrector* corrector)
+{
+    // the long FFT resolves the fundamental best, the high band gets its ratio in process
+    Low.setPitchCorrector(corrector);
+    High.setPitchCorrector(nullptr);
+}
+
+//------------------------------------------------------------------------
+void MultiResEngine::setDrivesCorrector(bool state)
+{
+    Low.setDrivesCorrector(state);
+}
+
+//------------------------------------------------------------------------
+void MultiResEngine::reset()
+{
+    Low.reset();
+    High.reset();
+    for (int ch = 0; ch < kMaxChannels; ch++)
+    {
+        for (int k = 0; k < 2; k++)
+        {
+            LowPass[ch][k].Z1 = LowPass[ch][k].Z2 = 0;
+            HighPass[ch][k].Z1 = HighPass[ch][k].Z2 = 0;
+        }
+    }
+}
+
+//------------------------------------------------------------------------
+int MultiResEngine::getLatencySamples() const
+{
+    return std::max(Low.getLatencySamples(), High.getLatencySamples());
+}
+
+//------------------------------------------------------------------------
+void MultiResEngine::process(float** in, float** out, int numChannels, int numSamples, float pitchRatio)
+{
+    run(in, out, numChannels, numSamples, pitchRatio, true);
+}
+
+//------------------------------------------------------------------------
+void MultiResEngine::feed(float** in, float** out, int numChannels, int numSamples)
+{
+    run(in, out, numChannels, numSamples, 1.f, false);
+}
+
+//------------------------------------------------------------------------
+void MultiResEngine::handOver(const SpectralEngine* const* to, int numTo)
+{
+    Low.handOver(to, numTo);
+    High.handOver(to, numTo);
+}
+
+//------------------------------------------------------------------------
+void MultiResEngine::takeOver(const SpectralEngine* const* from, int numFrom, int when)
+{
+    Low.takeOver(from, numFrom, when);
+    High.takeOver(from, numFrom, when);
+}
+
+//------------------------------------------------------------------------
+void MultiResEngine::run(float** in, float** out, int numChannels, int numSamples, float pitchRatio, bool takeFrames)
+{
+    numChannels = std::min(numChannels, NumChannels);
+
+    for (int pos = 0; pos < numSamples; pos += kChunkSize)
+    {
+        int n = std::min(numSamples - pos, (int)kChunkSize);
+        float* low[kMaxChannels];
+        float* high[kMaxChannels];
+        for (int ch = 0; ch < numChannels; ch++)
+        {
+            const float* pIn = in[ch] + pos;
+            low[ch] = &LowBuffer[ch][0];
+            high[ch] = &HighBuffer[ch][0];
+            for (int i = 0; i < n; i++)
+            {
+                float x = *(pIn + i);
+                low[ch][i] = LowPass[ch][1].process(LowPass[ch][0].process(x));
+                high[ch][i] = HighPass[ch][1].process(HighPass[ch][0].process(x));
+            }
+        }
+
+        if (takeFrames)
+        {
+            Low.process(low, low, numChannels, n, pitchRatio);
+            High.process(high, high, numChannels, n, pitchRatio * Low.getCorrectionRatio());
+        }
+        else
+        {
+            Low.feed(low, out ? low : nullptr, numChannels, n);
+            High.feed(high, out ? high : nullptr, numChannels, n);
+        }
+        if (!out)
+            continue;
+
+        for (int ch = 0; ch < numChannels; ch++)
+        {
+            float* pOut = out[ch] + pos;
+            for (int i = 0; i < n; i++)
+                *(pOut + i) = low[ch][i] + high[ch][i];
+        }
+    }
+}
+
+//------------------------------------------------------------------------
+} // namespace tobyCorp
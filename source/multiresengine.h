@@ -0,0 +1,90 @@
+//------------------------------------------------------------------------
+// Copyright(c) 2024 Toby Corp.
+//------------------------------------------------------------------------
+
+#pragma once
+
+#include "spectralengine.h"
+#include <valarray>
+
+namespace tobyCorp {
+
+//------------------------------------------------------------------------
+//  MultiResEngine
+//
+//  Splits the input in two bands with a Linkwitz-Riley crossover, whose
+//  bands add back up to the input with a flat response, and shifts each
+//  band with its own SpectralEngine: a long
+//  FFT with a long hop for the low band, where frequency resolution
+//  matters, and a short one for the high band, where transients do. Each
+//  band only runs the phase math on its own bins, and quiet bins above
+//  the cutoff are skipped. The high band is delayed to the latency of the
+//  low band, which is the one reported.
+//------------------------------------------------------------------------
+class MultiResEngine
+{
+public:
+    static const int kMaxChannels = SpectralEngine::kMaxChannels;
+
+    /** Allocates all buffers, must not be called from the audio thread.
+        The output is delayed further when needed to reach minLatency. */
+    void prepare(double sampleRate, int numChannels, bool spreadLoad, int minLatency = 0,
+                 float crossoverHz = 1000.f, float cutoffHz = 4000.f);
+    void setPhaseLock(bool state);
+    void setMultiThreaded(bool state);
+    void setStereoLink(bool state);
+    /** The low band's analysis drives the corrector, both bands follow it. */
+    void setPitchCorrector(PitchCorrector* corrector);
+    void setDrivesCorrector(bool state);
+    /** Clears the signal history without reallocating. */
+    void reset();
+    /** in and out may point to the same buffers. */
+    void process(float** in, float** out, int numChannels, int numSamples, float pitchRatio);
+    /** SpectralEngine::feed for both bands, out may be nullptr. */
+    void feed(float** in, float** out, int numChannels, int numSamples);
+    /** SpectralEngine::takeOver and handOver for both bands, each band picks its own frames. */
+    void takeOver(const SpectralEngine* const* from, int numFrom, int when);
+    void handOver(const SpectralEngine* const* to, int numTo);
+    /** The band engines, as the sources of another engine's takeOver. */
+    const SpectralEngine* getBand(int band) const { return band == 0 ? &Low : &High; }
+    int getLatencySamples() const;
+
+    static const int kLowFFTSize = 4096;
+    static const int kHighFFTSize = 1024;
+    static const int kOverlap = 4;
+    // bins above the cutoff this far under the loudest one are skipped, -80dB
+    static constexpr float kSkipFloor = 1e-4f;
+
+protected:
+    void run(float** in, float** out, int numChannels, int numSamples, float pitchRatio, bool takeFrames);
+
+    struct Biquad
+    {
+        float B0 = 1, B1 = 0, B2 = 0, A1 = 0, A2 = 0;
+        float Z1 = 0, Z2 = 0;
+
+        float process(float x)
+        {
+            // transposed direct form II
+            float y = B0 * x + Z1;
+            Z1 = B1 * x - A1 * y + Z2;
+            Z2 = B2 * x - A2 * y;
+            return y;
+        }
+    };
+
+    SpectralEngine Low;
+    SpectralEngine High;
+    int NumChannels = 2;
+
+    // fourth order Linkwitz-Riley, each band is two identical Butterworth sections
+    Biquad LowPass[kMaxChannels][2];
+    Biquad HighPass[kMaxChannels][2];
+
+    static const int kChunkSize = 256;
+    std::valarray<float> LowBuffer[kMaxChannels];
+    std::valarray<float> HighBuffer[kMaxChannels];
+};
+
+//------------------------------------------------------------------------
+} // namespace tobyCorp
@@ -0,0 +1,248 @@
+//------------------------------------------------------------------------
+// Copyright(c) 2024 Toby Corp.
+//------------------------------------------------------------------------
+
+#include "pitchcorrector.h"
+#include <algorithm>
+#include <math.h>
+
+namespace tobyCorp {
+
+static const int kNumHarmonics = 8;
+static const int kNumCandidatePeaks = 6;
+static const int kMaxDivisor = 4;          // a candidate peak may be up to the 4th harmonic
+static const float kMinPitch = 60.f;
+static const float kMaxPitch = 1000.f;
+static const float kSilence = 1e-3f;       // peak level under -60dBFS is not worth tracking
+static const float kVoicedShare = 0.25f;   // share of the spectrum the harmonics must carry
+
+// scale steps above the key, bit n for n semitones
+static const int kScaleMasks[PitchCorrector::kNumScales] = {
+    0xfff,  // chromatic
+    0xab5,  // major: 0 2 4 5 7 9 11
+    0x5ad,  // natural minor: 0 2 3 5 7 8 10
+};
+
+//------------------------------------------------------------------------
+// PitchCorrector
+//------------------------------------------------------------------------
+void PitchCorrector::prepare(double sampleRate)
+{
+    SampleRate = sampleRate;
+    reset();
+}
+
+//------------------------------------------------------------------------
+void PitchCorrector::reset()
+{
+    DetectedPitch = 0;
+    Correction = 0;
+    for (int n = 0; n < 128; n++)
+        HeldNotes[n] = false;
+    NumHeldNotes = 0;
+}
+
+//------------------------------------------------------------------------
+void PitchCorrector::setMode(int mode)
+{
+    Mode = std::min(std::max(mode, 0), (int)kNumModes - 1);
+}
+
+//------------------------------------------------------------------------
+void PitchCorrector::setKey(int key)
+{
+    Key = ((key % 12) + 12) % 12;
+}
+
+//------------------------------------------------------------------------
+void PitchCorrector::setScale(int scale)
+{
+    ScaleMask = kScaleMasks[std::min(std::max(scale, 0), (int)kNumScales - 1)];
+}
+
+//------------------------------------------------------------------------
+void PitchCorrector::setRetuneTime(float seconds)
+{
+    RetuneTime = std::max(seconds, 0.f);
+}
+
+//------------------------------------------------------------------------
+void PitchCorrector::noteOn(int pitch)
+{
+    if (pitch < 0 || pitch > 127 || HeldNotes[pitch])
+        return;
+    HeldNotes[pitch] = true;
+    NumHeldNotes++;
+}
+
+//------------------------------------------------------------------------
+void PitchCorrector::noteOff(int pitch)
+{
+    if (pitch < 0 || pitch > 127 || !HeldNotes[pitch])
+        return;
+    HeldNotes[pitch] = false;
+    NumHeldNotes--;
+}
+
+//------------------------------------------------------------------------
+float PitchCorrector::harmonicSum(const float* mag, const float* freq, int numBins, float f0) const
+{
+    // a bin only counts when its true frequency sits on the harmonic, not just its index,
+    // and later harmonics count less so half the true pitch scores lower than the pitch itself
+    float sum = 0;
+    float weight = 1;
+    for (int h = 1; h <= kNumHarmonics; h++, weight *= 0.8f)
+    {
+        float target = h * f0;
+        int bin = (int)(target + .5f);
+        if (bin >= numBins - 1)
+            break;
+
+        float tolerance = 0.25f + 0.05f * h;
+        float level = 0;
+        for (int b = std::max(bin - 1, 1); b <= bin + 1; b++)
+        {
+            float match = 1.f - fabsf(freq[b] - target) / tolerance;
+            if (match > 0)
+                level = std::max(level, mag[b] * match);
+        }
+        sum += weight * level;
+    }
+    return sum;
+}
+
+//------------------------------------------------------------------------
+float PitchCorrector::detect(const float* mag, const float* freq, int numBins, int fftSize)
+{
+    int peaks[kNumCandidatePeaks];
+    int numPeaks = 0;
+    for (int i = 1; i < numBins - 1; i++)
+    {
+        if (mag[i] <= mag[i - 1] || mag[i] < mag[i + 1])
+            continue;
+
+        // keep the strongest peaks sorted, loudest first
+        int pos = numPeaks;
+        while (pos > 0 && mag[peaks[pos - 1]] < mag[i])
+            pos--;
+        if (pos >= kNumCandidatePeaks)
+            continue;
+        numPeaks = std::min(numPeaks + 1, kNumCandidatePeaks);
+        for (int k = numPeaks - 1; k > pos; k--)
+            peaks[k] = peaks[k - 1];
+        peaks[pos] = i;
+    }
+    if (numPeaks == 0 || mag[peaks[0]] < kSilence * 0.25f * (float)fftSize)
+        return 0;
+
+    float binHz = (float)SampleRate / (float)fftSize;
+    float best = 0;
+    float bestScore = 0;
+    for (int p = 0; p < numPeaks; p++)
+    {
+        for (int d = 1; d <= kMaxDivisor; d++)
+        {
+            float f0 = freq[peaks[p]] / (float)d;
+            if (f0 * binHz < kMinPitch || f0 * binHz > kMaxPitch)
+                continue;
+            float score = harmonicSum(mag, freq, numBins, f0);
+            if (score > bestScore)
+            {
+                bestScore = score;
+                best = f0;
+            }
+        }
+    }
+    if (best <= 0)
+        return 0;
+
+    // noise spreads over every bin, a voiced frame has most of its level on the harmonics
+    int lastBin = std::min((int)(kNumHarmonics * best) + 2, numBins);
+    float total = 0;
+    for (int i = 1; i < lastBin; i++)
+        total += mag[i];
+    if (bestScore < kVoicedShare * total)
+        return 0;
+
+    // the harmonics' true frequencies divided by their number, weighted by level
+    float sum = 0;
+    float weights = 0;
+    for (int h = 1; h <= kNumHarmonics; h++)
+    {
+        int bin = (int)(h * best + .5f);
+        if (bin < 1 || bin >= numBins)
+            break;
+        sum += mag[bin] * freq[bin] / (float)h;
+        weights += mag[bin];
+    }
+    return weights > 0 ? sum / weights : best;
+}
+
+//------------------------------------------------------------------------
+float PitchCorrector::snap(float midiPitch) const
+{
+    int nearest = (int)floorf(midiPitch + .5f);
+    float bestDistance = 1e9f;
+    float target = midiPitch;
+
+    if (Mode == kModeMidi)
+    {
+        for (int n = 0; n < 128; n++)
+        {
+            if (HeldNotes[n] && fabsf((float)n - midiPitch) < bestDistance)
+            {
+                bestDistance = fabsf((float)n - midiPitch);
+                target = (float)n;
+            }
+        }
+        return target;
+    }
+
+    for (int n = nearest - 6; n <= nearest + 6; n++)
+    {
+        int step = ((n - Key) % 12 + 12) % 12;
+        if ((ScaleMask >> step & 1) && fabsf((float)n - midiPitch) < bestDistance)
+        {
+            bestDistance = fabsf((float)n - midiPitch);
+            target = (float)n;
+        }
+    }
+    return target;
+}
+
+//------------------------------------------------------------------------
+float PitchCorrector::update(const float* mag, const float* freq, int numBins, int fftSize, int hopSize)
+{
+    if (Mode == kModeOff)
+    {
+        Correction = 0;
+        return 1.f;
+    }
+
+    // unvoiced frames hold the last correction, so consonants don't jump around
+    float target = Correction;
+    float f0 = detect(mag, freq, numBins, fftSize);
+    if (f0 > 0)
+    {
+        DetectedPitch = f0 * (float)SampleRate / (float)fftSize;
+        float midiPitch = 69.f + 12.f * log2f(DetectedPitch / 440.f);
+        target = snap(midiPitch) - midiPitch;
+    }
+    if (Mode == kModeMidi && NumHeldNotes == 0)
+        target = 0;
+
+    float hopSeconds = (float)hopSize / (float)SampleRate;
+    float coeff = RetuneTime > 0 ? 1.f - expf(-hopSeconds / RetuneTime) : 1.f;
+    Correction += coeff * (target - Correction);
+
+    return powf(2.f, Correction / 12.f);
+}
+
+//------------------------------------------------------------------------
+float PitchCorrector::getRatio() const
+{
+    return Mode == kModeOff ? 1.f : powf(2.f, Correction / 12.f);
+}
+
+//------------------------------------------------------------------------
+} // namespace tobyCorp
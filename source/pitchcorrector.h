@@ -0,0 +1,76 @@
+//------------------------------------------------------------------------
+// Copyright(c) 2024 Toby Corp.
+//------------------------------------------------------------------------
+
+#pragma once
+
+namespace tobyCorp {
+
+//------------------------------------------------------------------------
+//  PitchCorrector
+//
+//  Finds the fundamental of a frame from the magnitudes and true bin
+//  frequencies the phase vocoder analysis has already computed, with a
+//  harmonic sum over the strongest peaks and their sub-harmonics, and
+//  returns the ratio that moves it to the nearest note of a scale or of
+//  the MIDI notes being held. The ratio glides to each new note with the
+//  retune time. It never looks at audio itself, so it costs no FFT and
+//  no latency.
+//------------------------------------------------------------------------
+class PitchCorrector
+{
+public:
+    enum Modes
+    {
+        kModeOff = 0,
+        kModeScale,
+        kModeMidi,
+        kNumModes
+    };
+
+    enum Scales
+    {
+        kScaleChromatic = 0,
+        kScaleMajor,
+        kScaleMinor,
+        kNumScales
+    };
+
+    void prepare(double sampleRate);
+    void reset();
+
+    void setMode(int mode);
+    int getMode() const { return Mode; }
+    void setKey(int key);           // 0 = C ... 11 = B
+    void setScale(int scale);
+    void setRetuneTime(float seconds);
+    void noteOn(int pitch);
+    void noteOff(int pitch);
+
+    /** Called once per analysis frame, returns the correction ratio for the next frame. */
+    float update(const float* mag, const float* freq, int numBins, int fftSize, int hopSize);
+    /** Ratio of the last update, held while nothing calls update, 1 when off. */
+    float getRatio() const;
+    /** Fundamental of the last voiced frame in Hz, 0 before the first one. */
+    float getDetectedPitch() const { return DetectedPitch; }
+
+protected:
+    float detect(const float* mag, const float* freq, int numBins, int fftSize);
+    float harmonicSum(const float* mag, const float* freq, int numBins, float f0) const;
+    float snap(float midiPitch) const;
+
+    double SampleRate = 44100;
+    int Mode = kModeOff;
+    int Key = 0;
+    int ScaleMask = 0xfff;          // bit n set when the n-th semitone above the key is in the scale
+    float RetuneTime = 0.05f;
+
+    bool HeldNotes[128] = {};
+    int NumHeldNotes = 0;
+
+    float DetectedPitch = 0;
+    float Correction = 0;           // current correction in semitones
+};
+
+//------------------------------------------------------------------------
+} // namespace tobyCorp
@@ -6,7 +6,11 @@
 #include "cids.h"
 #include "base/source/fstreamer.h"
 #include "pluginterfaces/vst/ivstparameterchanges.h"
+#include "pluginterfaces/vst/ivstevents.h"
+#include <algorithm>
+#include <chrono>
 #include <math.h>
+#include <thread>
 
 using namespace Steinberg;
 
@@ -60,210 +64,370 @@ tresult PLUGIN_API FFTPitchShiftProcessor::terminate ()
 tresult PLUGIN_API FFTPitchShiftProcessor::setActive (TBool state)
 {
 	//--- called when the Plug-in is enable/disable (On/Off) -----
+    if (state)
+    {
+        // buffers only depend on the FFT size, not on the host block size
+        bool offline = processSetup.processMode == Vst::kOffline;
+        int32 numChannels = SpectralEngine::kMaxChannels;
+
+        // the real-time layout comes first, hosts may keep its latency for a bounce
+        Engine.prepare(FFTSize, Overlap, numChannels, bSpreadLoad);
+        MultiRes.prepare(processSetup.sampleRate, numChannels, bSpreadLoad);
+        Wsola.prepare(processSetup.sampleRate, numChannels, MaxPitchRatio);
+        ReducedEngines[0].prepare(FFTSize, 2, numChannels, bSpreadLoad);
+        ReducedEngines[1].prepare(FFTSize / 2, 2, numChannels, bSpreadLoad);
+
+        EngineLatencies[kEngineSpectral] = Engine.getLatencySamples();
+        EngineLatencies[kEngineTimeDomain] = Wsola.getLatencySamples();
+        EngineLatencies[kEngineMultiRes] = MultiRes.getLatencySamples();
+        LevelLatency = std::max(std::max(Engine.getLatencySamples(), Wsola.getLatencySamples()),
+                                std::max(ReducedEngines[0].getLatencySamples(), ReducedEngines[1].getLatencySamples()));
+        GovernorLatency = getLayoutLatency(EngineMode, true);
+
+        // with the governor on, every engine is delayed to GovernorLatency, offline too
+        int32 minLatency = bGovernor ? GovernorLatency : 0;
+        int32 spectralLatency = std::max(EngineLatencies[kEngineSpectral], minLatency);
+        int32 multiResLatency = std::max(EngineLatencies[kEngineMultiRes], minLatency);
+        int32 wsolaLatency = std::max(EngineLatencies[kEngineTimeDomain], minLatency);
+
+        // offline renders don't have a deadline, so they get more overlap and phase locking.
+        // The FFT size stays, a longer one would need more latency than real time reports
+        if (offline)
+            Engine.prepare(FFTSize, OfflineOverlap, numChannels, false, spectralLatency);
+        else
+            Engine.prepare(FFTSize, Overlap, numChannels, bSpreadLoad, spectralLatency);
+        // a second thread only pays off with a second core to run it, the handoff costs every hop
+        bool threaded = offline && std::thread::hardware_concurrency() > 1;
+        Engine.setPhaseLock(offline);
+        Engine.setMultiThreaded(threaded);
+        Engine.setStereoLink(bStereoLink);
+
+        MultiRes.prepare(processSetup.sampleRate, numChannels, offline ? false : bSpreadLoad, multiResLatency);
+        MultiRes.setPhaseLock(offline);
+        MultiRes.setMultiThreaded(threaded);
+        MultiRes.setStereoLink(bStereoLink);
+
+        Wsola.prepare(processSetup.sampleRate, numChannels, MaxPitchRatio, wsolaLatency);
+
+        GovernorActive = bGovernor && !offline;
+        if (GovernorActive)
+        {
+            ReducedEngines[0].prepare(FFTSize, 2, numChannels, bSpreadLoad, GovernorLatency);
+            ReducedEngines[1].prepare(FFTSize / 2, 2, numChannels, bSpreadLoad, GovernorLatency);
+            ReducedEngines[0].setStereoLink(bStereoLink);
+            ReducedEngines[1].setStereoLink(bStereoLink);
+
+            Governor.prepare(kNumLevels, processSetup.sampleRate);
+            FadeLength = (int32)(0.02 * processSetup.sampleRate);
+            ScratchSize = std::max(processSetup.maxSamplesPerBlock, (int32)1);
+            for (int32 ch = 0; ch < 2; ch++)
+            {
+                InScratch[ch].resize(ScratchSize);
+                FadeScratch[ch].resize(ScratchSize);
+            }
+        }
+        // WSOLA has no analysis to give the corrector, it follows the last correction
+        Corrector.prepare(processSetup.sampleRate);
+        Engine.setPitchCorrector(&Corrector);
+        MultiRes.setPitchCorrector(&Corrector);
+        ReducedEngines[0].setPitchCorrector(&Corrector);
+        ReducedEngines[1].setPitchCorrector(&Corrector);
+
+        // every engine starts from a reset here, which lines up their frame grids with Clock
+        ActiveLevel = EngineMode == kEngineTimeDomain ? kLevelTimeDomain : kLevelFull;
+        ActiveRenderer = getRenderer(ActiveLevel);
+        FadeFrom = -1;
+        Clock = 0;
+        ReportedLevel = -1;
+        ReportedLatency = -1;
+    }
+    else
+    {
+        Engine.setMultiThreaded(false);
+        MultiRes.setMultiThreaded(false);
+    }
 	return AudioEffect::setActive (state);
 }
 float FFTPitchShiftProcessor::getfPitchRatio(float& val)
 {
     return powf(2.0f, val);
 }
-float FFTPitchShiftProcessor::wrapPhase(float phaseIn)
+
+int32 FFTPitchShiftProcessor::getLayoutLatency(int32 engine, bool governor) const
 {
-    if (phaseIn >= 0)
-        return fmodf(phaseIn + M_PI, 2.0 * M_PI) - M_PI;
-    else
-        return fmodf(phaseIn - M_PI, -2.0 * M_PI) + M_PI;
+    // with the governor on, the engine is padded to the slowest level it can step down to
+    if (governor)
+        return std::max(EngineLatencies[engine], LevelLatency);
+    return EngineLatencies[engine];
 }
 
-// methodology is from this tutorial video
-// https://youtu.be/2p_-jbl6Dyc?si=85sU6lSs_YuvOVyH&t=1741
-void FFTPitchShiftProcessor::processFFT(CArray &x)
+int32 FFTPitchShiftProcessor::getRenderer(int32 level) const
 {
-    for (size_t i = 0; i < FFTSize / 2; i++)
-        {
-            float amplitude = std::abs(x[i]);
-            float phase = std::arg(x[i]);
-
-            float phaseDiff = phase - LastInputPhases[i];
-
-            float binCentreFrequency = 2.f * M_PI * (float)i / (float)FFTSize;
-            phaseDiff = wrapPhase(phaseDiff - binCentreFrequency * (float)HopSize);
-
-            float binDeviation = phaseDiff * (float)FFTSize / (float)HopSize / (2.f * M_PI);
-            AnalysisFreq[i] = (float)i + binDeviation;
-            AnalysisMag[i] = amplitude;
-
-            LastInputPhases[i] = phase;
-        }
-
-    for (size_t i = 0; i < FFTSize / 2; i++)
-        {
-            SynthMag[i] = SynthFreq[i] = 0;
-        }
-
-        for (size_t i = 0; i < FFTSize / 2; i++)
-        {
-            int newBin = floorf(i * fPitchRatio + .5);
-
-            if (newBin <= FFTSize / 2)
-            {
-                SynthMag[newBin] += AnalysisMag[i];
-                SynthFreq[newBin] = AnalysisFreq[i] * fPitchRatio;
-            }
-        }
-
-        for (size_t i = 0; i < FFTSize / 2; i++)
-        {
-            float amplitude = SynthMag[i];
-
-            float binDeviation = SynthFreq[i] - i;
+    // the governor only pads the levels to the multi-resolution engine's latency when it was
+    // selected at activation, until the host reactivates us the spectral engine stands in
+    if (level == kLevelFull && EngineMode == kEngineMultiRes
+        && (!GovernorActive || GovernorLatency >= EngineLatencies[kEngineMultiRes]))
+        return kRenderMultiRes;
+    return level;
+}
 
-            float phaseDiff = binDeviation * 2.f * M_PI * (float)HopSize / (float)FFTSize;
+int32 FFTPitchShiftProcessor::getRendererHop(int32 renderer) const
+{
+    switch (renderer)
+    {
+        case kRenderFull: return FFTSize / Overlap;
+        case kRenderHalfOverlap: return FFTSize / 2;
+        case kRenderSmallFFT: return FFTSize / 4;
+        case kRenderMultiRes: return MultiResEngine::kLowFFTSize / MultiResEngine::kOverlap;
+    }
+    return 1;
+}
 
-            float binCentreFrequency = 2.f * M_PI * (float)i / (float)FFTSize;
-            phaseDiff += binCentreFrequency * (float)HopSize;
+void FFTPitchShiftProcessor::resetRenderer(int32 renderer)
+{
+    switch (renderer)
+    {
+        case kRenderFull: Engine.reset(); break;
+        case kRenderHalfOverlap: ReducedEngines[0].reset(); break;
+        case kRenderSmallFFT: ReducedEngines[1].reset(); break;
+        case kRenderTimeDomain: Wsola.reset(); break;
+        case kRenderMultiRes: MultiRes.reset(); break;
+    }
+}
 
-            float outPhase = wrapPhase(LastOutputPhases[i] + phaseDiff);
+void FFTPitchShiftProcessor::render(int32 renderer, Vst::Sample32** in, Vst::Sample32** out, int32 numChannels, int32 numSamples)
+{
+    switch (renderer)
+    {
+        case kRenderFull: Engine.process(in, out, numChannels, numSamples, fPitchRatio); break;
+        case kRenderHalfOverlap: ReducedEngines[0].process(in, out, numChannels, numSamples, fPitchRatio); break;
+        case kRenderSmallFFT: ReducedEngines[1].process(in, out, numChannels, numSamples, fPitchRatio); break;
+        case kRenderTimeDomain:
+            Wsola.process(in, out, numChannels, numSamples, std::min(fPitchRatio * Corrector.getRatio(), MaxPitchRatio));
+            break;
+        case kRenderMultiRes: MultiRes.process(in, out, numChannels, numSamples, fPitchRatio); break;
+    }
+}
 
-            x[i].real(amplitude * cosf(outPhase));
-            x[i].imag(amplitude * sinf(outPhase));
+void FFTPitchShiftProcessor::feed(int32 renderer, Vst::Sample32** in, Vst::Sample32** out, int32 numChannels, int32 numSamples)
+{
+    switch (renderer)
+    {
+        case kRenderFull: Engine.feed(in, out, numChannels, numSamples); break;
+        case kRenderHalfOverlap: ReducedEngines[0].feed(in, out, numChannels, numSamples); break;
+        case kRenderSmallFFT: ReducedEngines[1].feed(in, out, numChannels, numSamples); break;
+        case kRenderTimeDomain: Wsola.feed(in, out, numChannels, numSamples); break;
+        case kRenderMultiRes: MultiRes.feed(in, out, numChannels, numSamples); break;
+    }
+}
 
-            if (i > 0 && i < FFTSize / 2)
-            {
-                x[FFTSize - i].real(x[i].real());
-                x[FFTSize - i].imag(-1.f * x[i].imag());
-            }
-            LastOutputPhases[i] = outPhase;
-        }
+int32 FFTPitchShiftProcessor::getSpectralEngines(int32 renderer, const SpectralEngine** engines) const
+{
+    switch (renderer)
+    {
+        case kRenderFull: engines[0] = &Engine; return 1;
+        case kRenderHalfOverlap: engines[0] = &ReducedEngines[0]; return 1;
+        case kRenderSmallFFT: engines[0] = &ReducedEngines[1]; return 1;
+        case kRenderMultiRes:
+            engines[0] = MultiRes.getBand(0);
+            engines[1] = MultiRes.getBand(1);
+            return 2;
+    }
+    return 0;
 }
 
+void FFTPitchShiftProcessor::takeOver(int32 renderer, int32 from, int32 when)
+{
+    // WSOLA has no phases to hand over, a spectral engine replacing it only gets its analysis
+    const SpectralEngine* sources[2];
+    int32 numSources = getSpectralEngines(from, sources);
+    switch (renderer)
+    {
+        case kRenderFull: Engine.takeOver(sources, numSources, when); break;
+        case kRenderHalfOverlap: ReducedEngines[0].takeOver(sources, numSources, when); break;
+        case kRenderSmallFFT: ReducedEngines[1].takeOver(sources, numSources, when); break;
+        case kRenderTimeDomain: Wsola.setFollowing(true); break;
+        case kRenderMultiRes: MultiRes.takeOver(sources, numSources, when); break;
+    }
+}
 
-void FFTPitchShiftProcessor::processFFTR(CArray &x)
+void FFTPitchShiftProcessor::handOver(int32 renderer, int32 to)
 {
-    for (size_t i = 0; i < FFTSize / 2; i++)
-        {
-            float amplitude = std::abs(x[i]);
-            float phase = std::arg(x[i]);
+    const SpectralEngine* targets[2];
+    int32 numTargets = getSpectralEngines(to, targets);
+    switch (renderer)
+    {
+        case kRenderFull: Engine.handOver(targets, numTargets); break;
+        case kRenderHalfOverlap: ReducedEngines[0].handOver(targets, numTargets); break;
+        case kRenderSmallFFT: ReducedEngines[1].handOver(targets, numTargets); break;
+        case kRenderMultiRes: MultiRes.handOver(targets, numTargets); break;
+    }
+}
 
-            float phaseDiff = phase - LastInputPhasesR[i];
+void FFTPitchShiftProcessor::setCorrectorInput(int32 renderer)
+{
+    // only the renderer that is heard analyses for the corrector, the others follow its ratio,
+    // and on the time-domain level nothing does and the last correction holds
+    Engine.setDrivesCorrector(renderer == kRenderFull);
+    ReducedEngines[0].setDrivesCorrector(renderer == kRenderHalfOverlap);
+    ReducedEngines[1].setDrivesCorrector(renderer == kRenderSmallFFT);
+    MultiRes.setDrivesCorrector(renderer == kRenderMultiRes);
+}
 
-            float binCentreFrequency = 2.f * M_PI * (float)i / (float)FFTSize;
-            phaseDiff = wrapPhase(phaseDiff - binCentreFrequency * (float)HopSize);
+void FFTPitchShiftProcessor::startTransition(int32 level)
+{
+    int32 renderer = getRenderer(level);
+    FadeFrom = ActiveRenderer;
+    FadePos = 0;
+    // a spectral renderer starts with the old one's phases, so the two add up instead of cancelling
+    if (level == kLevelTimeDomain)
+    {
+        // WSOLA only needs its history, which it has, so a short crossfade is enough
+        FadeHandover = false;
+        FadeDelay = 0;
+        takeOver(renderer, FadeFrom, 0);
+    }
+    else if (FadeFrom == kRenderTimeDomain)
+    {
+        // once the new renderer's frames fill its latency, WSOLA's grains line up with it
+        FadeHandover = false;
+        FadeDelay = -1;
+        takeOver(renderer, FadeFrom, 0);
+    }
+    else if (level < ActiveLevel)
+    {
+        // stepping up, the load went down: render both until the new one's frames, from its next
+        // hop on, fill its latency
+        FadeHandover = false;
+        FadeDelay = GovernorLatency + getRendererHop(renderer);
+        takeOver(renderer, FadeFrom, 0);
+    }
+    else
+    {
+        // stepping down, or to the other full engine: the new renderer takes the frames whose
+        // output is centred more than a latency from now and the old one the frames before
+        // them, both overlap-add to the same output. They only both do FFTs while the longer
+        // frames of one reach past the other's
+        FadeHandover = true;
+        takeOver(renderer, FadeFrom, GovernorLatency);
+        handOver(FadeFrom, renderer);
+    }
+    ActiveLevel = level;
+    ActiveRenderer = renderer;
+}
 
-            float binDeviation = phaseDiff * (float)FFTSize / (float)HopSize / (2.f * M_PI);
-            AnalysisFreqR[i] = (float)i + binDeviation;
-            AnalysisMagR[i] = amplitude;
+void FFTPitchShiftProcessor::renderGoverned(Vst::Sample32** in, Vst::Sample32** out, int32 numChannels, int32 numSamples)
+{
+    numChannels = std::min(numChannels, (int32)2);
+    for (int32 pos = 0; pos < numSamples;)
+    {
+        int32 n = std::min(numSamples - pos, ScratchSize);
 
-            LastInputPhasesR[i] = phase;
+        Vst::Sample32* inCopy[2];
+        Vst::Sample32* fadeOut[2];
+        Vst::Sample32* pOut[2];
+        for (int32 ch = 0; ch < numChannels; ch++)
+        {
+            // every renderer needs the input, and out may be the same buffer
+            for (int32 i = 0; i < n; i++)
+                InScratch[ch][i] = *(in[ch] + pos + i);
+            inCopy[ch] = &InScratch[ch][0];
+            fadeOut[ch] = &FadeScratch[ch][0];
+            pOut[ch] = out[ch] + pos;
         }
 
-    for (size_t i = 0; i < FFTSize / 2; i++)
+        int32 heard = ActiveRenderer;
+        int32 fading = FadeFrom;
+        for (int32 r = 0; r < kNumRenderers; r++)
         {
-            SynthMagR[i] = SynthFreqR[i] = 0;
+            if (r != heard && r != fading)
+                feed(r, inCopy, nullptr, numChannels, n);
         }
+        setCorrectorInput(heard);
 
-        for (size_t i = 0; i < FFTSize / 2; i++)
+        // WSOLA records what the spectral renderer plays, to follow it when they are crossfaded
+        if (heard == kRenderTimeDomain && fading >= 0)
         {
-            int newBin = floorf(i * fPitchRatio + .5);
-
-            if (newBin <= FFTSize / 2)
-            {
-                SynthMagR[newBin] += AnalysisMagR[i];
-                SynthFreqR[newBin] = AnalysisFreqR[i] * fPitchRatio;
-            }
+            render(fading, inCopy, fadeOut, numChannels, n);
+            Wsola.follow(fadeOut, numChannels, n);
+            render(heard, inCopy, pOut, numChannels, n);
         }
-
-        for (size_t i = 0; i < FFTSize / 2; i++)
+        else
         {
-            float amplitude = SynthMagR[i];
-
-            float binDeviation = SynthFreqR[i] - i;
-
-            float phaseDiff = binDeviation * 2.f * M_PI * (float)HopSize / (float)FFTSize;
-
-            float binCentreFrequency = 2.f * M_PI * (float)i / (float)FFTSize;
-            phaseDiff += binCentreFrequency * (float)HopSize;
-
-            float outPhase = wrapPhase(LastOutputPhasesR[i] + phaseDiff);
-
-            x[i].real(amplitude * cosf(outPhase));
-            x[i].imag(amplitude * sinf(outPhase));
-
-            if (i > 0 && i < FFTSize / 2)
+            render(heard, inCopy, pOut, numChannels, n);
+            Wsola.follow(pOut, numChannels, n);
+            if (fading == kRenderTimeDomain && FadeDelay < 0 && FadePos >= GovernorLatency)
             {
-                x[FFTSize - i].real(x[i].real());
-                x[FFTSize - i].imag(-1.f * x[i].imag());
+                Wsola.setFollowing(true, true);
+                if (Wsola.isFollowing())
+                    FadeDelay = FadePos;
             }
-            LastOutputPhasesR[i] = outPhase;
+            if (fading >= 0)
+                render(fading, inCopy, fadeOut, numChannels, n);
         }
-}
 
-void FFTPitchShiftProcessor::SetWindow(int32 winSize)
-{
-    for (size_t i = 0; i < winSize; i++)
-    {
-        HWindow[i] = .5f * (1.f - cosf(2.f * M_PI * i / (float)(winSize - 1)));
-    }
-}
-
-//code obtained from this article https://rosettacode.org/wiki/Fast_Fourier_transform#C++
-void FFTPitchShiftProcessor::fft(CArray &x)
-{
-        // DFT
-        unsigned int N = (unsigned int)x.size(), k = N, n;
-        double thetaT = M_PI / N;
-        Complex phiT = Complex(cos(thetaT), -sin(thetaT)), T;
-        while (k > 1)
+        if (fading >= 0 && FadeHandover)
         {
-            n = k;
-            k >>= 1;
-            phiT = phiT * phiT;
-            T = 1.0L;
-            for (unsigned int l = 0; l < k; l++)
-            {
-                for (unsigned int a = l; a < N; a += n)
-                {
-                    unsigned int b = a + k;
-                    Complex t = x[a] - x[b];
-                    x[a] += x[b];
-                    x[b] = t * T;
-                }
-                T *= phiT;
-            }
+            // the old renderer's last frames play out under the new one's first
+            for (int32 ch = 0; ch < numChannels; ch++)
+                for (int32 i = 0; i < n; i++)
+                    *(pOut[ch] + i) += *(fadeOut[ch] + i);
+            FadePos += n;
+            if (FadePos >= 2 * GovernorLatency)
+                FadeFrom = -1;
         }
-    
-        // Decimate
-        unsigned int m = (unsigned int)log2(N);
-        for (unsigned int a = 0; a < N; a++)
+        else if (fading >= 0)
         {
-            unsigned int b = a;
-            // Reverse bits
-            b = (((b & 0xaaaaaaaa) >> 1) | ((b & 0x55555555) << 1));
-            b = (((b & 0xcccccccc) >> 2) | ((b & 0x33333333) << 2));
-            b = (((b & 0xf0f0f0f0) >> 4) | ((b & 0x0f0f0f0f) << 4));
-            b = (((b & 0xff00ff00) >> 8) | ((b & 0x00ff00ff) << 8));
-            b = ((b >> 16) | (b << 16)) >> (32 - m);
-            if (b > a)
+            // spectral renderers carry on each other's phases and add up linearly, WSOLA only
+            // lines up with the waveform and gets an equal power crossfade
+            bool equalPower = heard == kRenderTimeDomain || fading == kRenderTimeDomain;
+            for (int32 i = 0; i < n; i++)
+            {
+                int32 t = FadeDelay < 0 ? 0 : FadePos + i - FadeDelay;
+                float x = t <= 0 ? 0.f : std::min((float)t / (float)FadeLength, 1.f);
+                float gain = equalPower ? sinf(0.5f * (float)M_PI * x) : x;
+                float fadeGain = equalPower ? cosf(0.5f * (float)M_PI * x) : 1.f - x;
+                for (int32 ch = 0; ch < numChannels; ch++)
+                    *(pOut[ch] + i) = gain * *(pOut[ch] + i) + fadeGain * *(fadeOut[ch] + i);
+            }
+            FadePos += n;
+            if (FadeDelay >= 0 && FadePos >= FadeDelay + FadeLength)
             {
-                Complex t = x[a];
-                x[a] = x[b];
-                x[b] = t;
+                FadeFrom = -1;
+                Wsola.setFollowing(false);
             }
         }
+        Clock += n;
+        pos += n;
+    }
 }
 
-void FFTPitchShiftProcessor::ifft(CArray &x)
+void FFTPitchShiftProcessor::sendTelemetry(Vst::ProcessData& data)
 {
-    // conjugate the complex numbers
-        x = x.apply(std::conj);
-
-        // forward fft
-        fft(x);
-
-        // conjugate the complex numbers again
-        x = x.apply(std::conj);
+    if (!data.outputParameterChanges)
+        return;
+
+    int32 index = 0;
+    // the controller asks the host to restart when this changes, so the host only asks for
+    // the new latency once the processor has the parameters it depends on
+    int32 latency = (int32)getLatencySamples();
+    if (latency != ReportedLatency)
+    {
+        if (auto* queue = data.outputParameterChanges->addParameterData(kLatencyId, index))
+            queue->addPoint(0, (Vst::ParamValue)latency / kMaxReportedLatency, index);
+        ReportedLatency = latency;
+    }
 
-        // scale the numbers
-        x /= x.size();
+    if (!GovernorActive)
+        return;
+    if (ActiveLevel != ReportedLevel)
+    {
+        if (auto* queue = data.outputParameterChanges->addParameterData(kGovernorLevelId, index))
+            queue->addPoint(0, (Vst::ParamValue)ActiveLevel / (kNumLevels - 1), index);
+        ReportedLevel = ActiveLevel;
+    }
+    if (auto* queue = data.outputParameterChanges->addParameterData(kCpuLoadId, index))
+        queue->addPoint(0, std::min(Governor.getLoad(), 1.f), index);
 }
 //------------------------------------------------------------------------
 tresult PLUGIN_API FFTPitchShiftProcessor::process (Vst::ProcessData& data)
@@ -284,199 +448,117 @@ tresult PLUGIN_API FFTPitchShiftProcessor::process (Vst::ProcessData& data)
                 {
                     switch (paramQueue->getParameterId ())
                     {
-                        case 0:
+                        case kPitchId:
                             fPitch = (float)value;
                             
+                            break;
+                        case kEngineId:
+                            EngineMode = (int32)(value * (kNumEngines - 1) + 0.5);
+                            break;
+                        case kGovernorId:
+                            bGovernor = value > 0.5;
+                            break;
+                        case kCorrectionId:
+                            CorrectionMode = (int32)(value * (PitchCorrector::kNumModes - 1) + 0.5);
+                            Corrector.setMode(CorrectionMode);
+                            break;
+                        case kKeyId:
+                            CorrectionKey = (int32)(value * 11 + 0.5);
+                            Corrector.setKey(CorrectionKey);
+                            break;
+                        case kScaleId:
+                            CorrectionScale = (int32)(value * (PitchCorrector::kNumScales - 1) + 0.5);
+                            Corrector.setScale(CorrectionScale);
+                            break;
+                        case kRetuneId:
+                            fRetune = (float)value;
+                            Corrector.setRetuneTime(0.5f * fRetune);
+                            break;
+                        case kStereoLinkId:
+                            bStereoLink = value > 0.5;
+                            Engine.setStereoLink(bStereoLink);
+                            MultiRes.setStereoLink(bStereoLink);
+                            ReducedEngines[0].setStereoLink(bStereoLink);
+                            ReducedEngines[1].setStereoLink(bStereoLink);
                             break;
                     }
                 }
 			}
 		}
 	}
+	//--- Read input events, the corrector can follow held MIDI notes
+	if (data.inputEvents)
+	{
+		int32 numEvents = data.inputEvents->getEventCount ();
+		for (int32 index = 0; index < numEvents; index++)
+		{
+			Vst::Event event;
+			if (data.inputEvents->getEvent (index, event) != kResultOk)
+				continue;
+			switch (event.type)
+			{
+				case Vst::Event::kNoteOnEvent:
+					// a note-on with zero velocity is a note-off
+					if (event.noteOn.velocity > 0)
+						Corrector.noteOn (event.noteOn.pitch);
+					else
+						Corrector.noteOff (event.noteOn.pitch);
+					break;
+				case Vst::Event::kNoteOffEvent:
+					Corrector.noteOff (event.noteOff.pitch);
+					break;
+			}
+		}
+	}
+
     // portamento
     fPitchFollower = fPitchFollowerPrev + 0.1 * (fPitch-fPitchFollowerPrev);
     fPitchRatio = getfPitchRatio(fPitchFollower);
     fPitchFollowerPrev = fPitchFollower;
 	//--- Here you have to implement your processing
 
-    if(data.numInputs==0 || data.numOutputs==0){
+    if(data.numInputs==0 || data.numOutputs==0 || data.numSamples==0){
         return kResultOk;
     }
     
-    int32 numChannels = data.inputs[0].numChannels;
+    int32 numChannels = std::min(data.inputs[0].numChannels, data.outputs[0].numChannels);
     Vst::Sample32** in = data.inputs[0].channelBuffers32;
     Vst::Sample32** out = data.outputs[0].channelBuffers32;
-    if (numSamples ==0) // initialize necessary buffers
+
+    int32 level = EngineMode == kEngineTimeDomain ? kLevelTimeDomain : kLevelFull;
+    if (GovernorActive)
+        level = std::max(level, (int32)Governor.getLevel());
+
+    auto start = std::chrono::steady_clock::now();
+
+    if (GovernorActive)
     {
-        numSamples = data.numSamples;
-        HopSize = numSamples/4;
-        FFTSize = numSamples;
-        
-        CFFTBufferL1.resize(FFTSize);
-        CFFTBufferL2.resize(FFTSize);
-        CFFTBufferL3.resize(FFTSize);
-        CFFTBufferL4.resize(FFTSize);
-        
-        CFFTBufferR1.resize(FFTSize);
-        CFFTBufferR2.resize(FFTSize);
-        CFFTBufferR3.resize(FFTSize);
-        CFFTBufferR4.resize(FFTSize);
-        
-        CFFTBufferL1 = 0.0;
-        CFFTBufferL2 = 0.0;
-        CFFTBufferL3 = 0.0;
-        CFFTBufferL4 = 0.0;
-        
-        CFFTBufferR1 = 0.0;
-        CFFTBufferR2 = 0.0;
-        CFFTBufferR3 = 0.0;
-        CFFTBufferR4 = 0.0;
-        HWindow.resize(FFTSize);
-        
-        
-        LastInputPhases.resize(FFTSize);
-        LastOutputPhases.resize(FFTSize);
-        
-        LastInputPhasesR.resize(FFTSize);
-        LastOutputPhasesR.resize(FFTSize);
-        
-        AnalysisMag.resize(FFTSize);
-        AnalysisFreq.resize(FFTSize);
-        
-        AnalysisMagR.resize(FFTSize);
-        AnalysisFreqR.resize(FFTSize);
-        
-        
-        SynthMag.resize(FFTSize);
-        SynthFreq.resize(FFTSize);
-        
-        SynthMagR.resize(FFTSize);
-        SynthFreqR.resize(FFTSize);
-        
-        SetWindow(FFTSize);
+        // one transition at a time, a later change waits for the current one to finish
+        if (FadeFrom < 0 && getRenderer(level) != ActiveRenderer)
+            startTransition(level);
+        renderGoverned(in, out, numChannels, data.numSamples);
     }
-    
-    for (int32 ch =0; ch < numChannels; ch++) {
-        Vst::Sample32* pIn = in[ch];
-        Vst::Sample32* pOut = out[ch];
-        float tmp;
-        
-        for (int32 i = 0; i < data.numSamples; i++) {
-            *(pOut+i) =0; //initialize output buffer
-        }
-        for (int32 i = 0; i < data.numSamples; i++) {
-            
-            if(ch==0)
-            {
-                if(i<HopSize) 
-                {
-                    *(pOut+i) += CFFTBufferL2[HopSize*3+i].real() * HWindow[HopSize*3+i]; // add previous processed samples to the output buffer
-                    CFFTBufferL2[HopSize*3+i] = *(pIn+i) * HWindow[HopSize*3+i]; // not replace the same samples with new data.
-                }
-                if(i<HopSize*2)
-                {
-                    *(pOut+i) += CFFTBufferL3[HopSize*2+i].real() * HWindow[HopSize*2+i];
-                    CFFTBufferL3[HopSize*2+i] = *(pIn+i) * HWindow[HopSize*2+i];
-                }
-                if(i<HopSize*3)
-                {
-                    *(pOut+i) += CFFTBufferL4[HopSize+i].real() * HWindow[HopSize+i];
-                    CFFTBufferL4[HopSize+i] = *(pIn+i) * HWindow[HopSize+i];
-                }
-            }
-            else
-            {
-                if(i<HopSize)
-                {
-                    *(pOut+i) += CFFTBufferR2[HopSize*3+i].real() * HWindow[HopSize*3+i];
-                    CFFTBufferR2[HopSize*3+i] = *(pIn+i) * HWindow[HopSize*3+i];
-                }
-                if(i<HopSize*2)
-                {
-                    *(pOut+i) += CFFTBufferR3[HopSize*2+i].real() * HWindow[HopSize*2+i];
-                    CFFTBufferR3[HopSize*2+i] = *(pIn+i) * HWindow[HopSize*2+i];
-                }
-                if(i<HopSize*3)
-                {
-                    *(pOut+i) += CFFTBufferR4[HopSize+i].real() * HWindow[HopSize+i];
-                    CFFTBufferR4[HopSize+i] = *(pIn+i) * HWindow[HopSize+i];
-                }
-            }
-        }
-        //FFT process
-        if(ch ==0)
-        {
-            fft(CFFTBufferL1);
-            fft(CFFTBufferL2);
-            fft(CFFTBufferL3);
-            fft(CFFTBufferL4);
-            
-            processFFT(CFFTBufferL1);
-            processFFT(CFFTBufferL2);
-            processFFT(CFFTBufferL3);
-            processFFT(CFFTBufferL4);
-            
-            ifft(CFFTBufferL1);
-            ifft(CFFTBufferL2);
-            ifft(CFFTBufferL3);
-            ifft(CFFTBufferL4);
-        }
-        else
+    else
+    {
+        // engines have different latencies here, nothing to crossfade against
+        if (getRenderer(level) != ActiveRenderer)
         {
-            fft(CFFTBufferR1);
-            fft(CFFTBufferR2);
-            fft(CFFTBufferR3);
-            fft(CFFTBufferR4);
-            
-            processFFTR(CFFTBufferR1);
-            processFFTR(CFFTBufferR2);
-            processFFTR(CFFTBufferR3);
-            processFFTR(CFFTBufferR4);
-            
-            ifft(CFFTBufferR1);
-            ifft(CFFTBufferR2);
-            ifft(CFFTBufferR3);
-            ifft(CFFTBufferR4);
-        }
-
-        //add processed data into output buffer
-        for (int32 i = 0; i < data.numSamples; i++) {
-            if(ch==0)
-            {
-                tmp = CFFTBufferL1[i].real() * HWindow[i];
-                if(i>=HopSize) tmp += CFFTBufferL2[i-HopSize].real() * HWindow[i-HopSize];
-                if(i>=HopSize*2) tmp += CFFTBufferL3[i-HopSize*2].real() * HWindow[i-HopSize*2];
-                if(i>=HopSize*3) tmp += CFFTBufferL4[i-HopSize*3].real() * HWindow[i-HopSize*3];
-            }
-            else
-            {
-                tmp = CFFTBufferR1[i].real() * HWindow[i];
-                if(i>=HopSize) tmp += CFFTBufferR2[i-HopSize].real() * HWindow[i-HopSize];
-                if(i>=HopSize*2) tmp += CFFTBufferR3[i-HopSize*2].real() * HWindow[i-HopSize*2];
-                if(i>=HopSize*3) tmp += CFFTBufferR4[i-HopSize*3].real() * HWindow[i-HopSize*3];
-            }
-            *(pOut+i) += tmp;
-            //*(pOut+i) *= 0.25; <- doesn't need this, I adjusted window's highest amplitude.
-        }
-        //fill the buffer with current samples. Buffer 2, 3 and 4 will be fulfilled at next block.
-        for (int32 i = 0; i < data.numSamples; i++) {
-            if(ch==0)
-            {
-                CFFTBufferL1[i] = *(pIn + i) * HWindow[i];
-                if(i>=HopSize) CFFTBufferL2[i-HopSize] = *(pIn + i) * HWindow[i-HopSize];
-                if(i>=HopSize*2) CFFTBufferL3[i-HopSize*2] = *(pIn + i) * HWindow[i-HopSize*2];
-                if(i>=HopSize*3) CFFTBufferL4[i-HopSize*3] = *(pIn + i) * HWindow[i-HopSize*3];
-            }
-            else
-            {
-                CFFTBufferR1[i] = *(pIn + i) * HWindow[i];
-                if(i>=HopSize) CFFTBufferR2[i-HopSize] = *(pIn + i) * HWindow[i-HopSize];
-                if(i>=HopSize*2) CFFTBufferR3[i-HopSize*2] = *(pIn + i) * HWindow[i-HopSize*2];
-                if(i>=HopSize*3) CFFTBufferR4[i-HopSize*3] = *(pIn + i) * HWindow[i-HopSize*3];
-            }
+            ActiveRenderer = getRenderer(level);
+            resetRenderer(ActiveRenderer);
         }
+        ActiveLevel = level;
+        setCorrectorInput(ActiveRenderer);
+        render(ActiveRenderer, in, out, numChannels, data.numSamples);
     }
 
+    if (GovernorActive)
+    {
+        // two renderers overlap during a transition, that is not what the new level costs
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (FadeFrom < 0)
+            Governor.update(elapsed.count(), data.numSamples);
+    }
+    sendTelemetry(data);
     
 	return kResultOk;
 }
@@ -488,6 +570,15 @@ tresult PLUGIN_API FFTPitchShiftProcessor::setupProcessing (Vst::ProcessSetup& n
 	return AudioEffect::setupProcessing (newSetup);
 }
 
+//------------------------------------------------------------------------
+uint32 PLUGIN_API FFTPitchShiftProcessor::getLatencySamples ()
+{
+	// follows the parameters rather than the last activation, the host asks after the processor
+	// reported a change (see sendTelemetry) and reactivates us to apply it. The same in real time
+	// and offline, so hosts that don't ask again for a bounce stay aligned
+	return (uint32)getLayoutLatency(EngineMode, bGovernor);
+}
+
 //------------------------------------------------------------------------
 tresult PLUGIN_API FFTPitchShiftProcessor::canProcessSampleSize (int32 symbolicSampleSize)
 {
@@ -507,6 +598,48 @@ tresult PLUGIN_API FFTPitchShiftProcessor::setState (IBStream* state)
 {
 	// called when we load a preset, the model has to be reloaded
 	IBStreamer streamer (state, kLittleEndian);
+
+	// states saved before the engine parameter existed are empty, keep the defaults then
+	float savedPitch = 0.f;
+	if (streamer.readFloat (savedPitch))
+		fPitch = savedPitch;
+
+	int32 savedEngine = 0;
+	if (streamer.readInt32 (savedEngine))
+		EngineMode = std::min (std::max (savedEngine, (int32)0), (int32)kNumEngines - 1);
+
+	int32 savedGovernor = 0;
+	if (streamer.readInt32 (savedGovernor))
+		bGovernor = savedGovernor != 0;
+
+	int32 savedMode = 0;
+	if (streamer.readInt32 (savedMode))
+		CorrectionMode = std::min (std::max (savedMode, (int32)0), (int32)PitchCorrector::kNumModes - 1);
+
+	int32 savedKey = 0;
+	if (streamer.readInt32 (savedKey))
+		CorrectionKey = std::min (std::max (savedKey, (int32)0), (int32)11);
+
+	int32 savedScale = 0;
+	if (streamer.readInt32 (savedScale))
+		CorrectionScale = std::min (std::max (savedScale, (int32)0), (int32)PitchCorrector::kNumScales - 1);
+
+	float savedRetune = 0.f;
+	if (streamer.readFloat (savedRetune))
+		fRetune = savedRetune;
+
+	int32 savedLink = 0;
+	if (streamer.readInt32 (savedLink))
+		bStereoLink = savedLink != 0;
+
+	Corrector.setMode (CorrectionMode);
+	Corrector.setKey (CorrectionKey);
+	Corrector.setScale (CorrectionScale);
+	Corrector.setRetuneTime (0.5f * fRetune);
+	Engine.setStereoLink (bStereoLink);
+	MultiRes.setStereoLink (bStereoLink);
+	ReducedEngines[0].setStereoLink (bStereoLink);
+	ReducedEngines[1].setStereoLink (bStereoLink);
 	
 	return kResultOk;
 }
@@ -517,6 +650,15 @@ tresult PLUGIN_API FFTPitchShiftProcessor::getState (IBStream* state)
 	// here we need to save the model
 	IBStreamer streamer (state, kLittleEndian);
 
+	streamer.writeFloat (fPitch);
+	streamer.writeInt32 (EngineMode);
+	streamer.writeInt32 (bGovernor ? 1 : 0);
+	streamer.writeInt32 (CorrectionMode);
+	streamer.writeInt32 (CorrectionKey);
+	streamer.writeInt32 (CorrectionScale);
+	streamer.writeFloat (fRetune);
+	streamer.writeInt32 (bStereoLink ? 1 : 0);
+
 	return kResultOk;
 }
 
@@ -5,15 +5,37 @@
 #pragma once
 
 #include "public.sdk/source/vst/vstaudioeffect.h"
-#include <complex>
-#include <valarray>
-
-typedef std::complex<float> Complex;
-typedef std::valarray<Complex> CArray;
+#include "cids.h"
+#include "spectralengine.h"
+#include "multiresengine.h"
+#include "wsolaengine.h"
+#include "cpugovernor.h"
+#include "pitchcorrector.h"
 
 using namespace Steinberg;
 namespace tobyCorp {
 
+// quality levels the CPU governor steps through, best first
+enum QualityLevels
+{
+    kLevelFull = 0,     // FFTSize, Overlap, or the multi-resolution engine
+    kLevelHalfOverlap,  // FFTSize, 2x overlap
+    kLevelSmallFFT,     // FFTSize / 2, 2x overlap
+    kLevelTimeDomain,   // WSOLA
+    kNumLevels
+};
+
+// engines that render a level, the full level has two to choose from
+enum Renderers
+{
+    kRenderFull = 0,        // Engine
+    kRenderHalfOverlap,     // ReducedEngines[0]
+    kRenderSmallFFT,        // ReducedEngines[1]
+    kRenderTimeDomain,      // Wsola
+    kRenderMultiRes,        // MultiRes, on the full level
+    kNumRenderers
+};
+
 //------------------------------------------------------------------------
 //  FFTPitchShiftProcessor
 //------------------------------------------------------------------------
@@ -29,14 +51,19 @@ public:
 		return (Steinberg::Vst::IAudioProcessor*)new FFTPitchShiftProcessor; 
 	}
     float getfPitchRatio(float& val);
-    float wrapPhase(float phaseIn);
-    Steinberg::int32 wrapIndex(Steinberg::int32& val, const Steinberg::int32 maxVal);
-//  From https://rosettacode.org/wiki/Fast_Fourier_transform#C++
-    void fft(CArray& x);
-    void ifft(CArray& x);
-    void processFFT(CArray& x);
-    void processFFTR(CArray& x);
-    void SetWindow(int32 winSize);
+    int32 getLayoutLatency(int32 engine, bool governor) const;
+    int32 getRenderer(int32 level) const;
+    int32 getRendererHop(int32 renderer) const;
+    void resetRenderer(int32 renderer);
+    void render(int32 renderer, Vst::Sample32** in, Vst::Sample32** out, int32 numChannels, int32 numSamples);
+    void feed(int32 renderer, Vst::Sample32** in, Vst::Sample32** out, int32 numChannels, int32 numSamples);
+    int32 getSpectralEngines(int32 renderer, const SpectralEngine** engines) const;
+    void takeOver(int32 renderer, int32 from, int32 when);
+    void handOver(int32 renderer, int32 to);
+    void setCorrectorInput(int32 renderer);
+    void startTransition(int32 level);
+    void renderGoverned(Vst::Sample32** in, Vst::Sample32** out, int32 numChannels, int32 numSamples);
+    void sendTelemetry(Vst::ProcessData& data);
 
 	//--- ---------------------------------------------------------------------
 	// AudioEffect overrides:
@@ -53,6 +80,9 @@ public:
 	/** Will be called before any process call */
 	Steinberg::tresult PLUGIN_API setupProcessing (Steinberg::Vst::ProcessSetup& newSetup) SMTG_OVERRIDE;
 	
+	/** Gets the current Latency in samples. */
+	Steinberg::uint32 PLUGIN_API getLatencySamples () SMTG_OVERRIDE;
+
 	/** Asks if a given sample size is supported see SymbolicSampleSizes. */
 	Steinberg::tresult PLUGIN_API canProcessSampleSize (Steinberg::int32 symbolicSampleSize) SMTG_OVERRIDE;
 
@@ -65,46 +95,58 @@ public:
 
 //------------------------------------------------------------------------
 protected:
-    float fPitch;
+    float fPitch = 0;
     float fPitchFollower = 0;
     float fPitchFollowerPrev = 0;
     float fPitchRatio = 1;
     
-    Steinberg::int32 numSamples = 0;
-    
-    CArray CFFTBufferL1;
-    CArray CFFTBufferL2;
-    CArray CFFTBufferL3;
-    CArray CFFTBufferL4;
-     
-    CArray CFFTBufferR1;
-    CArray CFFTBufferR2;
-    CArray CFFTBufferR3;
-    CArray CFFTBufferR4;
-    
-    
-    std::valarray<float> HWindow;
-
-    std::valarray<Vst::Sample32> LastInputPhases;
-    std::valarray<Vst::Sample32> LastOutputPhases;
-    std::valarray<Vst::Sample32> LastInputPhasesR;
-    std::valarray<Vst::Sample32> LastOutputPhasesR;
-    std::valarray<Vst::Sample32> LastInputPhases2;
-    std::valarray<Vst::Sample32> LastOutputPhases2;
-    std::valarray<Vst::Sample32> LastInputPhasesR2;
-    std::valarray<Vst::Sample32> LastOutputPhasesR2;
-    std::valarray<Vst::Sample32> AnalysisMag;
-    std::valarray<Vst::Sample32> AnalysisFreq;
-    std::valarray<Vst::Sample32> AnalysisMagR;
-    std::valarray<Vst::Sample32> AnalysisFreqR;
-    std::valarray<Vst::Sample32> SynthMag;
-    std::valarray<Vst::Sample32> SynthFreq;
-    std::valarray<Vst::Sample32> SynthMagR;
-    std::valarray<Vst::Sample32> SynthFreqR;
-    
-    int32 HopSize = 512;
+    int32 EngineMode = 0;
+    int32 ActiveLevel = kLevelFull;
+    int32 ActiveRenderer = kRenderFull;
+    SpectralEngine Engine;
+    MultiResEngine MultiRes;
+    SpectralEngine ReducedEngines[2]; // kLevelHalfOverlap and kLevelSmallFFT
+    WsolaEngine Wsola;
+
+    // fed by the spectral engines' analysis and by the event bus
+    PitchCorrector Corrector;
+    int32 CorrectionMode = PitchCorrector::kModeOff;
+    int32 CorrectionKey = 0;
+    int32 CorrectionScale = PitchCorrector::kScaleChromatic;
+    float fRetune = 0.1f;
+
+    bool bStereoLink = false; // one phase trajectory per bin for both channels
+
+    // with the governor on, every level is delayed to GovernorLatency so switching
+    // levels never moves the audio in time. The renderers that aren't heard are fed
+    // the input, so their history and frame grids stay in step with the heard one
+    bool bGovernor = false;         // parameter, applied at the next activation
+    bool GovernorActive = false;
+    int32 GovernorLatency = 0;
+    CpuGovernor Governor;
+    int64 Clock = 0;                // samples since activation
+    int32 FadeFrom = -1;            // renderer being faded out, -1 when not fading
+    bool FadeHandover = false;      // it hands its frames over to the new one and plays out
+    int32 FadeDelay = 0;            // otherwise it is crossfaded over FadeLength after FadeDelay,
+                                    // -1 until WSOLA follows the new renderer
+    int32 FadePos = 0;
+    int32 FadeLength = 1024;
+    int32 ReportedLevel = -1;
+    int32 ScratchSize = 0;
+    std::valarray<Vst::Sample32> InScratch[2];
+    std::valarray<Vst::Sample32> FadeScratch[2];
+    bool bSpreadLoad = true; // spread each frame's work over the callbacks of one hop
+
     int32 FFTSize = 1024;
-    
+    int32 Overlap = 4;
+    int32 OfflineOverlap = 16; // offline keeps FFTSize, so its latency matches real time
+
+    // real-time latency of each engine and the longest one of the governor levels,
+    // offline renders are padded to the same values
+    int32 EngineLatencies[kNumEngines] = {};
+    int32 LevelLatency = 0;
+    int32 ReportedLatency = -1;
+    float MaxPitchRatio = 2; // pitch parameter at 1
 };
 
 //------------------------------------------------------------------------
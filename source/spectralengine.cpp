@@ -0,0 +1,987 @@
+//------------------------------------------------------------------------
+// Copyright(c) 2024 Toby Corp.
+//------------------------------------------------------------------------
+
+#include "spectralengine.h"
+#include <algorithm>
+#include <climits>
+#include <math.h>
+
+namespace tobyCorp {
+
+// one unit each for the forward FFT, the bin remap and the inverse FFT
+static const int kUnitsPerChannel = 3;
+// both forward FFTs, the linked remap and both inverse FFTs
+static const int kLinkedUnits = 5;
+
+//------------------------------------------------------------------------
+// SpectralEngine
+//------------------------------------------------------------------------
+SpectralEngine::~SpectralEngine()
+{
+    setMultiThreaded(false);
+}
+
+//------------------------------------------------------------------------
+void SpectralEngine::prepare(int fftSize, int overlap, int numChannels, bool spreadLoad, int minLatency)
+{
+    FFTSize = fftSize;
+    HopSize = fftSize / overlap;
+    NumChannels = std::min(std::max(numChannels, 1), (int)kMaxChannels);
+    SpreadLoad = spreadLoad;
+    UnitsPerFrame = NumChannels * kUnitsPerChannel;
+
+    Padding = 0;
+    Padding = std::max(minLatency - getLatencySamples(), 0);
+    OutSize = FFTSize + Padding;
+
+    // sum of the squared Hann windows overlapping at any sample is 3/8 * overlap,
+    // at 2x overlap the windows are square roots of Hann and add up to one
+    OutputGain = overlap == 2 ? 1.f : 1.f / (0.375f * (float)overlap);
+
+    HWindow.resize(FFTSize);
+    SetWindow(FFTSize);
+
+    // everything in the phase math that only depends on the frame layout
+    BinAdvance.resize(FFTSize / 2);
+    for (int i = 0; i < FFTSize / 2; i++)
+    {
+        float binCentreFrequency = 2.f * M_PI * (float)i / (float)FFTSize;
+        BinAdvance[i] = binCentreFrequency * (float)HopSize;
+    }
+    DeviationScale = (float)FFTSize / (float)HopSize / (2.f * M_PI);
+    AdvanceScale = 2.f * M_PI * (float)HopSize / (float)FFTSize;
+    RemapBins.resize(FFTSize / 2);
+    TableRatio = 0;
+
+    FirstBin = 0;
+    LastBin = SkipBin = FFTSize / 2;
+    SparseBins = false;
+
+    for (int ch = 0; ch < kMaxChannels; ch++)
+    {
+        Channel& c = Channels[ch];
+        c.InFifo.resize(FFTSize);
+        c.OutAccum.resize(OutSize);
+        c.Frame.resize(FFTSize);
+
+        c.LastInputPhases.resize(FFTSize);
+        c.LastOutputPhases.resize(FFTSize);
+        c.AnalysisMag.resize(FFTSize);
+        c.AnalysisFreq.resize(FFTSize);
+        c.SynthMag.resize(FFTSize);
+        c.SynthFreq.resize(FFTSize);
+
+        c.AnalysisPhase.resize(FFTSize);
+        c.SynthSource.resize(FFTSize);
+        c.PeakBins.resize(FFTSize);
+
+        c.Spectrum.resize(FFTSize / 2);
+    }
+    LinkRef.resize(FFTSize / 2);
+    LinkMag.resize(FFTSize / 2);
+    Linked = false;
+    Elapsed = 0;
+    reset();
+}
+
+//------------------------------------------------------------------------
+void SpectralEngine::setPhaseLock(bool state)
+{
+    PhaseLock = state;
+}
+
+//------------------------------------------------------------------------
+void SpectralEngine::setBinRange(int firstBin, int lastBin)
+{
+    FirstBin = std::min(std::max(firstBin, 0), FFTSize / 2);
+    LastBin = std::min(std::max(lastBin, FirstBin), FFTSize / 2);
+    SparseBins = FirstBin > 0 || LastBin < FFTSize / 2 || SkipBin < LastBin;
+
+    // the corrector reads the whole analysis, bins outside the range stay silent there
+    for (int ch = 0; ch < kMaxChannels; ch++)
+    {
+        Channels[ch].AnalysisMag = 0.f;
+        Channels[ch].AnalysisFreq = 0.f;
+    }
+}
+
+//------------------------------------------------------------------------
+void SpectralEngine::setSkipQuietBins(int cutoffBin, float floor)
+{
+    SkipBin = std::max(cutoffBin, 0);
+    SkipFloor = floor;
+    SparseBins = FirstBin > 0 || LastBin < FFTSize / 2 || SkipBin < LastBin;
+}
+
+//------------------------------------------------------------------------
+void SpectralEngine::setStereoLink(bool state)
+{
+    StereoLink = state;
+}
+
+//------------------------------------------------------------------------
+void SpectralEngine::setPitchCorrector(PitchCorrector* corrector)
+{
+    Corrector = corrector;
+    CorrectionRatio = 1;
+}
+
+//------------------------------------------------------------------------
+void SpectralEngine::setDrivesCorrector(bool state)
+{
+    DrivesCorrector = state;
+}
+
+//------------------------------------------------------------------------
+void SpectralEngine::setMultiThreaded(bool state)
+{
+    if (state == Worker.joinable())
+        return;
+
+    if (state)
+    {
+        WorkerQuit = false;
+        WorkerFirst = -1;
+        Worker = std::thread(&SpectralEngine::workerLoop, this);
+    }
+    else
+    {
+        {
+            std::lock_guard<std::mutex> lock(WorkerMutex);
+            WorkerQuit = true;
+        }
+        WorkerWake.notify_one();
+        Worker.join();
+    }
+}
+
+//------------------------------------------------------------------------
+void SpectralEngine::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(WorkerMutex);
+    while (true)
+    {
+        WorkerWake.wait(lock, [this] { return WorkerQuit || WorkerFirst >= 0; });
+        if (WorkerQuit)
+            return;
+
+        int first = WorkerFirst;
+        int last = WorkerLast;
+        lock.unlock();
+        runUnits(first, last);
+        lock.lock();
+
+        WorkerFirst = -1;
+        WorkerDone.notify_one();
+    }
+}
+
+//------------------------------------------------------------------------
+void SpectralEngine::reset()
+{
+    for (int ch = 0; ch < kMaxChannels; ch++)
+    {
+        Channel& c = Channels[ch];
+        c.InFifo = 0.f;
+        c.OutAccum = 0.f;
+        c.Frame = 0.f;
+        c.LastInputPhases = 0.f;
+        c.LastOutputPhases = 0.f;
+        c.Spectrum = Complex(1.f, 0.f);
+        c.PhaseTime = Elapsed;
+    }
+    LinkRef = 0;
+    InPos = OutPos = HopCounter = 0;
+    CorrectionRatio = 1;
+    FramePending = false;
+    NextUnit = 0;
+    WorkCredit = 0;
+    CaptureTime = Elapsed;
+    FirstOutput = LLONG_MIN;
+    LastOutput = LLONG_MAX;
+    NumSources = 0;
+    Seeding = false;
+}
+
+//------------------------------------------------------------------------
+int SpectralEngine::getLatencySamples() const
+{
+    // a frame taken at the hop boundary is overlap-added right away, or one hop later when spread
+    return (SpreadLoad ? FFTSize + HopSize : FFTSize) + Padding;
+}
+
+//------------------------------------------------------------------------
+float SpectralEngine::wrapPhase(float phaseIn) const
+{
+    if (phaseIn >= 0)
+        return fmodf(phaseIn + M_PI, 2.0 * M_PI) - M_PI;
+    else
+        return fmodf(phaseIn - M_PI, -2.0 * M_PI) + M_PI;
+}
+
+// methodology is from this tutorial video
+// https://youtu.be/2p_-jbl6Dyc?si=85sU6lSs_YuvOVyH&t=1741
+void SpectralEngine::processFFT(CArray &x, Channel &c)
+{
+    float gate = skipGate(x, x);
+    for (size_t i = FirstBin; i < LastBin; i++)
+        {
+            if (i >= SkipBin && std::norm(x[i]) < gate)
+            {
+                // too quiet to hear, picks its phase up again once it gets louder
+                c.AnalysisMag[i] = 0;
+                c.AnalysisFreq[i] = (float)i;
+                continue;
+            }
+
+            float amplitude = std::abs(x[i]);
+            float phase = std::arg(x[i]);
+
+            float phaseDiff = phase - c.LastInputPhases[i];
+            phaseDiff = wrapPhase(phaseDiff - BinAdvance[i]);
+
+            float binDeviation = phaseDiff * DeviationScale;
+            c.AnalysisFreq[i] = (float)i + binDeviation;
+            c.AnalysisMag[i] = amplitude;
+            c.AnalysisPhase[i] = phase;
+
+            c.LastInputPhases[i] = phase;
+        }
+
+    // the corrector works on the analysis above, the second channel may be on the worker thread
+    // so the ratio it returns waits for the next frame
+    if (Corrector && DrivesCorrector && &c == &Channels[0])
+        CorrectionRatio = Corrector->update(&c.AnalysisMag[0], &c.AnalysisFreq[0], FFTSize / 2, FFTSize, HopSize);
+
+    for (size_t i = 0; i < FFTSize / 2; i++)
+        {
+            c.SynthMag[i] = c.SynthFreq[i] = 0;
+            c.SynthSource[i] = -1;
+        }
+
+        // RemapBins only holds the bins that land under Nyquist
+        int lastRemap = std::min(LastBin, NumRemapBins);
+        for (int i = FirstBin; i < lastRemap; i++)
+        {
+            int newBin = RemapBins[i];
+
+            // the locked path takes the frequency of the loudest bin instead of the last one
+            int src = c.SynthSource[newBin];
+            if (!PhaseLock || src < 0 || c.AnalysisMag[i] >= c.AnalysisMag[src])
+            {
+                c.SynthFreq[newBin] = c.AnalysisFreq[i] * fPitchRatio;
+                c.SynthSource[newBin] = i;
+            }
+            c.SynthMag[newBin] += c.AnalysisMag[i];
+        }
+
+        for (size_t i = 0; i < FFTSize / 2; i++)
+        {
+            if (SparseBins && c.SynthMag[i] == 0)
+                continue;
+
+            float binDeviation = c.SynthFreq[i] - i;
+
+            float phaseDiff = binDeviation * AdvanceScale;
+            phaseDiff += BinAdvance[i];
+
+            c.LastOutputPhases[i] = wrapPhase(c.LastOutputPhases[i] + phaseDiff);
+        }
+
+        if (PhaseLock)
+            lockPhases(c, c.SynthMag);
+
+        for (size_t i = 0; i < FFTSize / 2; i++)
+        {
+            float amplitude = c.SynthMag[i];
+            float outPhase = c.LastOutputPhases[i];
+
+            if (SparseBins && amplitude == 0)
+                x[i] = 0;
+            else
+            {
+                x[i].real(amplitude * cosf(outPhase));
+                x[i].imag(amplitude * sinf(outPhase));
+            }
+
+            if (i > 0 && i < FFTSize / 2)
+            {
+                x[FFTSize - i].real(x[i].real());
+                x[FFTSize - i].imag(-1.f * x[i].imag());
+            }
+        }
+}
+
+// identity phase locking (Laroche & Dolson): only the peaks advance by their own
+// frequency, the bins around a peak keep the phase offset they had in the input
+void SpectralEngine::lockPhases(Channel &c, const std::valarray<float>& mag)
+{
+    int numBins = FFTSize / 2;
+    int numPeaks = 0;
+    for (int i = 1; i < numBins - 1; i++)
+    {
+        if (mag[i] > mag[i - 1] && mag[i] >= mag[i + 1])
+            c.PeakBins[numPeaks++] = i;
+    }
+    if (numPeaks == 0)
+        return;
+
+    int peak = 0;
+    for (int i = 0; i < numBins; i++)
+    {
+        // each bin belongs to the closest peak
+        while (peak < numPeaks - 1 && c.PeakBins[peak + 1] - i < i - c.PeakBins[peak])
+            peak++;
+
+        int peakBin = c.PeakBins[peak];
+        int src = c.SynthSource[i];
+        int peakSrc = c.SynthSource[peakBin];
+        if (i == peakBin || src < 0)
+            continue;
+
+        c.LastOutputPhases[i] = wrapPhase(c.LastOutputPhases[peakBin] + c.AnalysisPhase[src] - c.AnalysisPhase[peakSrc]);
+    }
+}
+
+// stereo link: the phase of each bin is analysed and advanced once, following the louder
+// channel of its source bin; the other channel keeps the phase offset it has to that one
+void SpectralEngine::processLinked()
+{
+    Channel& l = Channels[0];
+    Channel& r = Channels[1];
+    int numBins = FFTSize / 2;
+
+    float gate = skipGate(l.Frame, r.Frame);
+    for (int i = FirstBin; i < LastBin; i++)
+    {
+        if (i >= SkipBin && std::norm(l.Frame[i]) < gate && std::norm(r.Frame[i]) < gate)
+        {
+            l.AnalysisMag[i] = r.AnalysisMag[i] = 0;
+            l.AnalysisFreq[i] = (float)i;
+            continue;
+        }
+
+        float magL = std::abs(l.Frame[i]);
+        float magR = std::abs(r.Frame[i]);
+        Channel& ref = magR > magL ? r : l;
+
+        // phase change of the louder channel since its last frame, one atan2 for both
+        float phaseDiff = std::arg(ref.Frame[i] * std::conj(ref.Spectrum[i]));
+        phaseDiff = wrapPhase(phaseDiff - BinAdvance[i]);
+
+        l.AnalysisFreq[i] = (float)i + phaseDiff * DeviationScale;
+        l.AnalysisMag[i] = magL;
+        r.AnalysisMag[i] = magR;
+        if (PhaseLock)
+            l.AnalysisPhase[i] = std::arg(ref.Frame[i]);
+
+        // a silent bin reads as phase 0 next frame, like std::arg(0) does in processFFT
+        l.Spectrum[i] = magL > 0 ? l.Frame[i] : Complex(1.f, 0.f);
+        r.Spectrum[i] = magR > 0 ? r.Frame[i] : Complex(1.f, 0.f);
+    }
+
+    if (Corrector && DrivesCorrector)
+        CorrectionRatio = Corrector->update(&l.AnalysisMag[0], &l.AnalysisFreq[0], numBins, FFTSize, HopSize);
+
+    for (int i = 0; i < numBins; i++)
+    {
+        l.SynthMag[i] = r.SynthMag[i] = l.SynthFreq[i] = 0;
+        l.SynthSource[i] = -1;
+    }
+
+    int lastRemap = std::min(LastBin, NumRemapBins);
+    for (int i = FirstBin; i < lastRemap; i++)
+    {
+        int newBin = RemapBins[i];
+
+        int src = l.SynthSource[newBin];
+        if (!PhaseLock || src < 0 || l.AnalysisMag[i] + r.AnalysisMag[i] >= l.AnalysisMag[src] + r.AnalysisMag[src])
+        {
+            l.SynthFreq[newBin] = l.AnalysisFreq[i] * fPitchRatio;
+            l.SynthSource[newBin] = i;
+        }
+        l.SynthMag[newBin] += l.AnalysisMag[i];
+        r.SynthMag[newBin] += r.AnalysisMag[i];
+    }
+
+    for (int i = 0; i < numBins; i++)
+    {
+        if (SparseBins && l.SynthMag[i] == 0 && r.SynthMag[i] == 0)
+            continue;
+
+        float binDeviation = l.SynthFreq[i] - i;
+        float phase = l.LastOutputPhases[i] + binDeviation * AdvanceScale + BinAdvance[i];
+
+        // when the other channel gets louder the trajectory takes over its offset to the
+        // old one, so neither channel's phase jumps
+        int src = l.SynthSource[i];
+        if (src >= 0)
+        {
+            int ref = r.AnalysisMag[src] > l.AnalysisMag[src] ? 1 : 0;
+            if (ref != LinkRef[i])
+            {
+                phase += std::arg(Channels[ref].Spectrum[src] * std::conj(Channels[LinkRef[i]].Spectrum[src]));
+                LinkRef[i] = ref;
+            }
+        }
+        l.LastOutputPhases[i] = wrapPhase(phase);
+    }
+
+    if (PhaseLock)
+    {
+        for (int i = 0; i < numBins; i++)
+            LinkMag[i] = l.SynthMag[i] + r.SynthMag[i];
+        lockPhases(l, LinkMag);
+    }
+
+    for (int i = 0; i < numBins; i++)
+    {
+        if (SparseBins && l.SynthMag[i] == 0 && r.SynthMag[i] == 0)
+        {
+            l.Frame[i] = r.Frame[i] = 0;
+            if (i > 0)
+                l.Frame[FFTSize - i] = r.Frame[FFTSize - i] = 0;
+            continue;
+        }
+
+        Complex phasor(cosf(l.LastOutputPhases[i]), sinf(l.LastOutputPhases[i]));
+        int src = l.SynthSource[i];
+        Channel& ref = Channels[LinkRef[i]];
+
+        for (int ch = 0; ch < 2; ch++)
+        {
+            Channel& c = Channels[ch];
+            Complex y = c.SynthMag[i] * phasor;
+
+            float norm = src >= 0 ? c.AnalysisMag[src] * ref.AnalysisMag[src] : 0.f;
+            if (&c != &ref && norm > 0)
+                y *= c.Spectrum[src] * std::conj(ref.Spectrum[src]) / norm;
+
+            c.Frame[i] = y;
+            if (i > 0)
+                c.Frame[FFTSize - i] = std::conj(y);
+        }
+    }
+}
+
+// the linked path reads last frame's spectra and one output trajectory per bin, the unlinked one
+// per-channel phases; each starts from where the other one left off, so toggling doesn't click
+void SpectralEngine::switchLink(bool linked)
+{
+    Channel& l = Channels[0];
+    Channel& r = Channels[1];
+    for (int i = 0; i < FFTSize / 2; i++)
+    {
+        if (linked)
+        {
+            l.Spectrum[i] = std::polar(1.f, l.LastInputPhases[i]);
+            r.Spectrum[i] = std::polar(1.f, r.LastInputPhases[i]);
+
+            // the louder channel keeps its trajectory, the other one takes its offset to it
+            LinkRef[i] = r.SynthMag[i] > l.SynthMag[i] ? 1 : 0;
+            l.LastOutputPhases[i] = Channels[LinkRef[i]].LastOutputPhases[i];
+        }
+        else
+        {
+            l.LastInputPhases[i] = std::arg(l.Spectrum[i]);
+            r.LastInputPhases[i] = std::arg(r.Spectrum[i]);
+
+            // what each channel was last given
+            float left = outputPhase(0, i);
+            r.LastOutputPhases[i] = outputPhase(1, i);
+            l.LastOutputPhases[i] = left;
+        }
+    }
+}
+
+void SpectralEngine::handOver(const SpectralEngine* const* to, int numTo)
+{
+    // up to half a hop of theirs before each of their first frames
+    LastOutput = LLONG_MIN;
+    for (int e = 0; e < numTo; e++)
+        LastOutput = std::max(LastOutput, to[e]->firstCentre() - to[e]->HopSize / 2);
+}
+
+//------------------------------------------------------------------------
+void SpectralEngine::takeOver(const SpectralEngine* const* from, int numFrom, int when)
+{
+    NumSources = std::min(numFrom, kMaxSources);
+    for (int e = 0; e < NumSources; e++)
+        Sources[e] = from[e];
+    FirstOutput = Elapsed + when;
+
+    // the frame grids may not line up there: the first frame goes where each source has its
+    // last one, up to half a hop of this engine before it, no more than half of both hops
+    // before it. A later fade in than fade out leaves a gap, an earlier one only a bump
+    for (int tries = 0; tries < kMaxHandoverHops; tries++)
+    {
+        long long centre = firstCentre();
+        bool fits = true;
+        for (int e = 0; e < NumSources; e++)
+        {
+            const SpectralEngine& s = *Sources[e];
+            fits = fits && centre - s.centreBefore(centre - HopSize / 2) <= (s.HopSize + HopSize) / 2;
+        }
+        if (fits)
+            break;
+        FirstOutput = centre;
+    }
+    LastOutput = LLONG_MAX;
+    Seeding = true;
+}
+
+//------------------------------------------------------------------------
+// where the output of the next frame is centred
+long long SpectralEngine::nextCentre() const
+{
+    return Elapsed + HopSize - HopCounter + getLatencySamples() - FFTSize / 2;
+}
+
+//------------------------------------------------------------------------
+// where the output of the first frame it takes after FirstOutput is centred
+long long SpectralEngine::firstCentre() const
+{
+    long long next = nextCentre();
+    if (next > FirstOutput)
+        return next;
+    return next + ((FirstOutput - next) / HopSize + 1) * HopSize;
+}
+
+//------------------------------------------------------------------------
+// the last frame centre of its grid up to time
+long long SpectralEngine::centreBefore(long long time) const
+{
+    long long next = nextCentre();
+    if (time >= next)
+        return next + (time - next) / HopSize * HopSize;
+    return next - ((next - time + HopSize - 1) / HopSize) * HopSize;
+}
+
+//------------------------------------------------------------------------
+// phase the last frame gave a channel at a bin, linked that is the trajectory plus the channel's
+// offset to the reference
+float SpectralEngine::outputPhase(int ch, int bin) const
+{
+    const Channel& l = Channels[0];
+    const Channel& r = Channels[1];
+    float trajectory = l.LastOutputPhases[bin];
+    if (!Linked)
+        return Channels[ch].LastOutputPhases[bin];
+    if (ch == LinkRef[bin])
+        return trajectory;
+
+    int src = l.SynthSource[bin];
+    if (src < 0 || l.AnalysisMag[src] * r.AnalysisMag[src] <= 0)
+        return trajectory;
+    float offset = std::arg(r.Spectrum[src] * std::conj(l.Spectrum[src]));
+    return wrapPhase(ch == 1 ? trajectory + offset : trajectory - offset);
+}
+
+// the frame at the boundary is only analysed. Each bin's output phase is the phase of the
+// source partial at the centre of the source's last frame, where its bins add up, carried at
+// the partial's frequency to the centre of this engine's frame at the boundary. A bin's phase at
+// the frame start is pi k off the one at the centre, all bins start in phase at the centre so
+// the bins of a partial don't cancel each other there
+void SpectralEngine::seedPhases()
+{
+    for (int ch = 0; ch < NumChannels; ch++)
+    {
+        Channel& c = Channels[ch];
+        for (int i = 0; i < FFTSize; i++)
+            c.Frame[i] = c.InFifo[(InPos + i) % FFTSize] * HWindow[i];
+        fft(c.Frame);
+        for (int i = 0; i < FFTSize / 2; i++)
+        {
+            c.LastInputPhases[i] = std::arg(c.Frame[i]);
+            c.Spectrum[i] = std::abs(c.Frame[i]) > 0 ? c.Frame[i] : Complex(1.f, 0.f);
+        }
+        c.PhaseTime = Elapsed;
+    }
+
+    Linked = StereoLink && NumChannels == 2;
+    for (int i = 0; i < FFTSize / 2; i++)
+    {
+        const SpectralEngine* src = nullptr;
+        int srcBin = 0;
+        float srcMag = 0;
+        for (int e = 0; e < NumSources; e++)
+        {
+            // a longer FFT has several bins where this one has one
+            const SpectralEngine& s = *Sources[e];
+            int centre = (int)floorf((float)i * (float)s.FFTSize / (float)FFTSize + .5f);
+            int reach = std::max(s.FFTSize / FFTSize, 1);
+            for (int k = std::max(centre - reach, 0); k <= std::min(centre + reach, s.FFTSize / 2 - 1); k++)
+            {
+                float mag = 0;
+                for (int ch = 0; ch < s.NumChannels; ch++)
+                    mag += s.Channels[ch].SynthMag[k];
+                if (mag > srcMag)
+                {
+                    src = &s;
+                    srcBin = k;
+                    srcMag = mag;
+                }
+            }
+        }
+        float flip = i % 2 ? (float)M_PI : 0.f;
+        if (!src)
+        {
+            for (int ch = 0; ch < NumChannels; ch++)
+                Channels[ch].LastOutputPhases[i] = flip;
+            LinkRef[i] = 0;
+            continue;
+        }
+
+        int ref = src->NumChannels > 1 && src->Channels[1].SynthMag[srcBin] > src->Channels[0].SynthMag[srcBin] ? 1 : 0;
+        for (int ch = 0; ch < NumChannels; ch++)
+        {
+            // the main lobe of a Hann window is four bins wide
+            Complex partial(0.f, 0.f);
+            for (int k = std::max(srcBin - 2, 0); k <= std::min(srcBin + 2, src->FFTSize / 2 - 1); k++)
+                partial += std::polar(src->Channels[ch].SynthMag[k], src->outputPhase(ch, k) + (k % 2 ? (float)M_PI : 0.f));
+
+            // from the centre of the source's frame to the centre of this one, in output time
+            float age = (float)(Elapsed - src->Channels[ch].PhaseTime);
+            float distance = (float)(getLatencySamples() - FFTSize / 2)
+                - (float)(src->getLatencySamples() - src->FFTSize / 2) + age;
+            float freq = src->Channels[src->Linked ? 0 : ch].SynthFreq[srcBin];
+            float advance = 2.f * M_PI * freq / (float)src->FFTSize * distance;
+            float phase = wrapPhase(std::arg(partial) + advance - flip);
+            if (!Linked)
+                Channels[ch].LastOutputPhases[i] = phase;
+            else if (ch == ref)
+            {
+                Channels[0].LastOutputPhases[i] = phase;
+                LinkRef[i] = ref;
+            }
+        }
+    }
+}
+
+// squared magnitude under which bins from SkipBin up are skipped, 0 when nothing is
+float SpectralEngine::skipGate(const CArray& a, const CArray& b) const
+{
+    if (SkipBin >= LastBin)
+        return 0;
+
+    float peak = 0;
+    for (int i = FirstBin; i < LastBin; i++)
+        peak = std::max(peak, std::max(std::norm(a[i]), std::norm(b[i])));
+    return peak * SkipFloor * SkipFloor;
+}
+
+void SpectralEngine::SetWindow(int winSize)
+{
+    // periodic Hann, so that the squared windows overlap-add to a constant
+    for (size_t i = 0; i < winSize; i++)
+    {
+        HWindow[i] = .5f * (1.f - cosf(2.f * M_PI * i / (float)winSize));
+        if (HopSize * 2 == winSize)
+            HWindow[i] = sqrtf(HWindow[i]);
+    }
+}
+
+//code obtained from this article https://rosettacode.org/wiki/Fast_Fourier_transform#C++
+void SpectralEngine::fft(CArray &x)
+{
+        // DFT
+        unsigned int N = (unsigned int)x.size(), k = N, n;
+        double thetaT = M_PI / N;
+        Complex phiT = Complex(cos(thetaT), -sin(thetaT)), T;
+        while (k > 1)
+        {
+            n = k;
+            k >>= 1;
+            phiT = phiT * phiT;
+            T = 1.0L;
+            for (unsigned int l = 0; l < k; l++)
+            {
+                for (unsigned int a = l; a < N; a += n)
+                {
+                    unsigned int b = a + k;
+                    Complex t = x[a] - x[b];
+                    x[a] += x[b];
+                    x[b] = t * T;
+                }
+                T *= phiT;
+            }
+        }
+
+        // Decimate
+        unsigned int m = (unsigned int)log2(N);
+        for (unsigned int a = 0; a < N; a++)
+        {
+            unsigned int b = a;
+            // Reverse bits
+            b = (((b & 0xaaaaaaaa) >> 1) | ((b & 0x55555555) << 1));
+            b = (((b & 0xcccccccc) >> 2) | ((b & 0x33333333) << 2));
+            b = (((b & 0xf0f0f0f0) >> 4) | ((b & 0x0f0f0f0f) << 4));
+            b = (((b & 0xff00ff00) >> 8) | ((b & 0x00ff00ff) << 8));
+            b = ((b >> 16) | (b << 16)) >> (32 - m);
+            if (b > a)
+            {
+                Complex t = x[a];
+                x[a] = x[b];
+                x[b] = t;
+            }
+        }
+}
+
+void SpectralEngine::ifft(CArray &x)
+{
+    // conjugate in place, x.apply() would allocate on the audio thread
+    for (size_t i = 0; i < x.size(); i++)
+        x[i] = std::conj(x[i]);
+
+    // forward fft
+    fft(x);
+
+    // conjugate the complex numbers again and scale
+    float scale = 1.f / (float)x.size();
+    for (size_t i = 0; i < x.size(); i++)
+        x[i] = std::conj(x[i]) * scale;
+}
+
+//------------------------------------------------------------------------
+void SpectralEngine::captureFrame()
+{
+    // InPos is the oldest sample, so the frame is the ring unrolled from there
+    for (int ch = 0; ch < NumChannels; ch++)
+    {
+        Channel& c = Channels[ch];
+        for (int i = 0; i < FFTSize; i++)
+        {
+            c.Frame[i] = c.InFifo[(InPos + i) % FFTSize] * HWindow[i];
+        }
+    }
+    // an engine that doesn't drive the corrector takes the ratio it holds now, on the audio thread
+    if (Corrector && !DrivesCorrector)
+        CorrectionRatio = Corrector->getRatio();
+    fPitchRatio = fNextPitchRatio * CorrectionRatio;
+    updateRemap();
+    CaptureTime = Elapsed;
+
+    // the unit layout only changes between frames
+    bool linked = StereoLink && NumChannels == 2;
+    if (linked != Linked)
+        switchLink(linked);
+    Linked = linked;
+    UnitsPerFrame = Linked ? kLinkedUnits : NumChannels * kUnitsPerChannel;
+    FramePending = true;
+    NextUnit = 0;
+    WorkCredit = 0;
+}
+
+//------------------------------------------------------------------------
+void SpectralEngine::updateRemap()
+{
+    // a held pitch reuses the table. A glide rebuilds it every frame: a partial written to the
+    // neighbouring bin starts that bin's phase over and the output never lines up again
+    if (fPitchRatio == TableRatio)
+        return;
+
+    TableRatio = fPitchRatio;
+    NumRemapBins = 0;
+    for (int i = 0; i < FFTSize / 2; i++)
+    {
+        int newBin = floorf(i * TableRatio + .5);
+        if (newBin >= FFTSize / 2)
+            break;
+        RemapBins[NumRemapBins++] = newBin;
+    }
+}
+
+//------------------------------------------------------------------------
+void SpectralEngine::runUnit(int unit)
+{
+    if (Linked)
+    {
+        if (unit < 2)
+            fft(Channels[unit].Frame);
+        else if (unit == 2)
+        {
+            processLinked();
+            Channels[0].PhaseTime = Channels[1].PhaseTime = CaptureTime;
+        }
+        else
+            ifft(Channels[unit - 3].Frame);
+        return;
+    }
+
+    Channel& c = Channels[unit / kUnitsPerChannel];
+    switch (unit % kUnitsPerChannel)
+    {
+        case 0: fft(c.Frame); break;
+        case 1: processFFT(c.Frame, c); c.PhaseTime = CaptureTime; break;
+        case 2: ifft(c.Frame); break;
+    }
+}
+
+//------------------------------------------------------------------------
+void SpectralEngine::runUnits(int first, int last)
+{
+    for (int unit = first; unit < last; unit++)
+        runUnit(unit);
+}
+
+//------------------------------------------------------------------------
+bool SpectralEngine::runWorkUnit()
+{
+    if (!FramePending || NextUnit >= UnitsPerFrame)
+        return false;
+
+    runUnit(NextUnit++);
+    return true;
+}
+
+//------------------------------------------------------------------------
+void SpectralEngine::startWorker(int first, int last)
+{
+    {
+        std::lock_guard<std::mutex> lock(WorkerMutex);
+        WorkerFirst = first;
+        WorkerLast = last;
+    }
+    WorkerWake.notify_one();
+}
+
+//------------------------------------------------------------------------
+void SpectralEngine::waitForWorker()
+{
+    std::unique_lock<std::mutex> lock(WorkerMutex);
+    WorkerDone.wait(lock, [this] { return WorkerFirst < 0; });
+}
+
+//------------------------------------------------------------------------
+void SpectralEngine::finishFrame()
+{
+    if (!FramePending)
+        return;
+
+    // with a worker, the second channel's frame runs next to the first one,
+    // linked channels only split their FFTs since the remap needs both
+    if (Worker.joinable() && NumChannels > 1 && NextUnit == 0)
+    {
+        if (Linked)
+        {
+            startWorker(1, 2);
+            runUnits(0, 1);
+            waitForWorker();
+            runUnit(2);
+            startWorker(4, 5);
+            runUnits(3, 4);
+            waitForWorker();
+        }
+        else
+        {
+            startWorker(kUnitsPerChannel, 2 * kUnitsPerChannel);
+            runUnits(0, kUnitsPerChannel);
+            waitForWorker();
+        }
+        NextUnit = UnitsPerFrame;
+    }
+
+    while (runWorkUnit())
+        ;
+
+    // the frame starts with the next sample to be sent out, plus the padding
+    for (int ch = 0; ch < NumChannels; ch++)
+    {
+        Channel& c = Channels[ch];
+        for (int i = 0; i < FFTSize; i++)
+        {
+            c.OutAccum[(OutPos + Padding + i) % OutSize] += c.Frame[i].real() * HWindow[i] * OutputGain;
+        }
+    }
+    FramePending = false;
+}
+
+//------------------------------------------------------------------------
+void SpectralEngine::process(float** in, float** out, int numChannels, int numSamples, float pitchRatio)
+{
+    fNextPitchRatio = pitchRatio;
+    run(in, out, numChannels, numSamples, true);
+}
+
+//------------------------------------------------------------------------
+void SpectralEngine::feed(float** in, float** out, int numChannels, int numSamples)
+{
+    run(in, out, numChannels, numSamples, false);
+}
+
+//------------------------------------------------------------------------
+void SpectralEngine::run(float** in, float** out, int numChannels, int numSamples, bool takeFrames)
+{
+    numChannels = std::min(numChannels, NumChannels);
+
+    int pos = 0;
+    while (pos < numSamples)
+    {
+        int segment = std::min(numSamples - pos, HopSize - HopCounter);
+
+        // pay off the pending frame in proportion to the samples of this segment
+        if (SpreadLoad && FramePending)
+        {
+            WorkCredit += (float)segment * (float)UnitsPerFrame / (float)HopSize;
+            while (WorkCredit >= 1.f && runWorkUnit())
+                WorkCredit -= 1.f;
+        }
+
+        for (int ch = 0; ch < numChannels; ch++)
+        {
+            Channel& c = Channels[ch];
+            float* pIn = in[ch] + pos;
+            int inIdx = InPos;
+            int outIdx = OutPos;
+            if (!out)
+            {
+                for (int i = 0; i < segment; i++)
+                {
+                    c.InFifo[inIdx] = *(pIn + i);
+                    c.OutAccum[outIdx] = 0;
+                    if (++inIdx == FFTSize) inIdx = 0;
+                    if (++outIdx == OutSize) outIdx = 0;
+                }
+                continue;
+            }
+
+            float* pOut = out[ch] + pos;
+            for (int i = 0; i < segment; i++)
+            {
+                float tmp = *(pIn + i); // read first, the host may process in place
+                *(pOut + i) = c.OutAccum[outIdx];
+                c.OutAccum[outIdx] = 0;
+                c.InFifo[inIdx] = tmp;
+                if (++inIdx == FFTSize) inIdx = 0;
+                if (++outIdx == OutSize) outIdx = 0;
+            }
+        }
+        InPos = (InPos + segment) % FFTSize;
+        OutPos = (OutPos + segment) % OutSize;
+        HopCounter += segment;
+        Elapsed += segment;
+        pos += segment;
+
+        if (HopCounter == HopSize)
+        {
+            HopCounter = 0;
+            finishFrame();
+
+            // where the output of a frame taken now is centred
+            long long centre = Elapsed + getLatencySamples() - FFTSize / 2;
+            if (takeFrames && Seeding && centre + HopSize > FirstOutput)
+            {
+                seedPhases();
+                Seeding = false;
+            }
+            else if (takeFrames && !Seeding && centre > FirstOutput && centre <= LastOutput)
+                captureFrame();
+            if (!SpreadLoad)
+                finishFrame();
+        }
+    }
+}
+
+//------------------------------------------------------------------------
+} // namespace tobyCorp
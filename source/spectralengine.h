@@ -0,0 +1,225 @@
+//------------------------------------------------------------------------
+// Copyright(c) 2024 Toby Corp.
+//------------------------------------------------------------------------
+
+#pragma once
+
+#include <complex>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <valarray>
+#include "pitchcorrector.h"
+
+typedef std::complex<float> Complex;
+typedef std::valarray<Complex> CArray;
+
+namespace tobyCorp {
+
+//------------------------------------------------------------------------
+//  SpectralEngine
+//
+//  Streaming phase vocoder with a fixed FFT size that does not depend on
+//  the host block size. A new frame is taken from the input every HopSize
+//  samples.
+//
+//  With spreadLoad off, the whole frame (forward FFT, bin remap, inverse
+//  FFT for every channel) is done at the hop boundary, so callbacks that
+//  cross a boundary are much heavier than the ones that don't.
+//  With spreadLoad on, the frame work is cut into units that are done a
+//  few at a time in proportion to the samples of each callback, and the
+//  frame is overlap-added at the next hop boundary. This costs HopSize
+//  samples of extra latency but keeps the worst-case callback close to
+//  the average one.
+//
+//  The bin remap comes from a table that is reused only while the pitch
+//  ratio stays bit-identical, so a held pitch costs no per-bin rounding
+//  at all; any change of the ratio rebuilds it for the next frame.
+//
+//  A band of a band-split engine can be limited to its own bins, and bins
+//  above a cutoff that are far under the loudest one can be skipped.
+//
+//  In stereo link mode the phase analysis and synthesis run once per bin
+//  instead of once per channel. Each bin follows the louder channel and
+//  the other channel keeps its phase offset to it, so the stereo image
+//  doesn't smear.
+//
+//  The high quality settings used for offline rendering lock the phases
+//  of the bins around each spectral peak to the peak, and can run the
+//  second channel's frame on a worker thread.
+//------------------------------------------------------------------------
+class SpectralEngine
+{
+public:
+    static const int kMaxChannels = 2;
+
+    ~SpectralEngine();
+
+    /** Allocates all buffers, must not be called from the audio thread.
+        The output is delayed further when needed to reach minLatency. */
+    void prepare(int fftSize, int overlap, int numChannels, bool spreadLoad, int minLatency = 0);
+    /** Peak phase locking, less phasiness for more CPU. */
+    void setPhaseLock(bool state);
+    /** Only bins in [firstBin, lastBin) are analysed and resynthesised, the others stay
+        silent. Reset by prepare. */
+    void setBinRange(int firstBin, int lastBin);
+    /** Bins from cutoffBin up that are more than floor under the frame's loudest bin skip
+        the phase math and stay silent. Reset by prepare. */
+    void setSkipQuietBins(int cutoffBin, float floor);
+    /** One phase trajectory per bin for both channels, only the magnitudes stay per channel.
+        Applies from the next frame. */
+    void setStereoLink(bool state);
+    /** Starts or stops the worker thread, must not be called from the audio thread. */
+    void setMultiThreaded(bool state);
+    /** The corrector gets the first channel's analysis of every frame, nullptr turns it off. */
+    void setPitchCorrector(PitchCorrector* corrector);
+    /** Off, the corrector doesn't get this engine's analysis and the engine follows the ratio
+        another engine got from it, for engines that aren't heard. */
+    void setDrivesCorrector(bool state);
+    /** Clears the signal history without reallocating. */
+    void reset();
+    /** in and out may point to the same buffers. */
+    void process(float** in, float** out, int numChannels, int numSamples, float pitchRatio);
+    /** Keeps the input history running without taking new frames, what is left of the frames
+        already taken still plays out to out, which may be nullptr. Costs no FFT, so an engine
+        that isn't heard can take over at any time without a gap in its input. */
+    void feed(float** in, float** out, int numChannels, int numSamples);
+    /** For an engine that was only fed: process() takes no frames whose output is centred up
+        to when samples from now. At the hop boundary before the first one it analyses its
+        frame, so the first frame it takes reads the right frequencies, and starts each bin's
+        phase where the loudest source bin around its frequency has it then, so its frames add
+        up with what the sources play out instead of cancelling it. The sources must stay
+        prepared until then. */
+    void takeOver(const SpectralEngine* const* from, int numFrom, int when);
+    /** The other side of takeOver, once the engines taking over were told when: process()
+        takes no more frames than it needs while their first frames fade in, the ones taken
+        still play out. */
+    void handOver(const SpectralEngine* const* to, int numTo);
+    int getLatencySamples() const;
+    /** Ratio the corrector asked for, 1 without a corrector. */
+    float getCorrectionRatio() const { return CorrectionRatio; }
+
+    float wrapPhase(float phaseIn) const;
+//  From https://rosettacode.org/wiki/Fast_Fourier_transform#C++
+    void fft(CArray& x);
+    void ifft(CArray& x);
+    void SetWindow(int winSize);
+
+protected:
+    struct Channel
+    {
+        std::valarray<float> InFifo;
+        std::valarray<float> OutAccum;
+        CArray Frame;
+
+        std::valarray<float> LastInputPhases;
+        std::valarray<float> LastOutputPhases;
+        std::valarray<float> AnalysisMag;
+        std::valarray<float> AnalysisFreq;
+        std::valarray<float> SynthMag;
+        std::valarray<float> SynthFreq;
+
+        // phase locking only
+        std::valarray<float> AnalysisPhase;
+        std::valarray<int> SynthSource;   // loudest analysis bin moved into each synthesis bin
+        std::valarray<int> PeakBins;
+
+        // stereo link only
+        CArray Spectrum;                  // this frame's analysis spectrum, the last frame's until then
+        long long PhaseTime = 0;          // when the frame LastOutputPhases belongs to was taken
+    };
+
+    void processFFT(CArray& x, Channel& c);
+    void processLinked();
+    void switchLink(bool linked);
+    float outputPhase(int ch, int bin) const;
+    void seedPhases();
+    long long nextCentre() const;
+    long long firstCentre() const;
+    long long centreBefore(long long time) const;
+    void lockPhases(Channel& c, const std::valarray<float>& mag);
+    float skipGate(const CArray& a, const CArray& b) const;
+    void captureFrame();
+    void updateRemap();
+    bool runWorkUnit();
+    void runUnit(int unit);
+    void runUnits(int first, int last);
+    void startWorker(int first, int last);
+    void waitForWorker();
+    void finishFrame();
+    void workerLoop();
+    void run(float** in, float** out, int numChannels, int numSamples, bool takeFrames);
+
+    Channel Channels[kMaxChannels];
+    std::valarray<float> HWindow;
+
+    int FFTSize = 1024;
+    int HopSize = 256;
+    int NumChannels = 2;
+    bool SpreadLoad = true;
+    float OutputGain = 1;
+    int Padding = 0;        // extra output delay on top of the natural latency
+    int OutSize = 1024;     // OutAccum length, FFTSize + Padding
+
+    // per bin constants of the phase math, built in prepare
+    std::valarray<float> BinAdvance;    // phase advance of each bin centre over one hop
+    float DeviationScale = 1;           // phase error over one hop to bins
+    float AdvanceScale = 1;             // bins to phase advance over one hop
+
+    // target bin of each analysis bin for TableRatio, rebuilt by updateRemap
+    std::valarray<int> RemapBins;
+    int NumRemapBins = 0;
+    float TableRatio = 0;
+
+    // band and sparsity limits, everything is processed by default
+    int FirstBin = 0;
+    int LastBin = 512;
+    int SkipBin = 512;
+    float SkipFloor = 0;
+    bool SparseBins = false;    // some bins are skipped, silent ones don't need their phase advanced
+
+    float fPitchRatio = 1;      // ratio used by the frame being processed
+    float fNextPitchRatio = 1;  // ratio for the next captured frame
+    float CorrectionRatio = 1;  // from the corrector, applies from the next captured frame
+    PitchCorrector* Corrector = nullptr;
+    bool DrivesCorrector = true;
+
+    int InPos = 0;      // oldest sample in InFifo, next one to be overwritten
+    int OutPos = 0;     // next sample to be sent out from OutAccum
+    int HopCounter = 0;
+
+    // handover between engines: frames are only taken while their output is centred after
+    // FirstOutput and no later than LastOutput. Elapsed counts the samples run since prepare,
+    // the same for all engines prepared together, so engines can tell each other's frame times
+    static const int kMaxSources = 2;
+    static const int kMaxHandoverHops = 8;
+    long long Elapsed = 0;
+    long long FirstOutput = 0;
+    long long LastOutput = 0;
+    const SpectralEngine* Sources[kMaxSources] = {};
+    int NumSources = 0;
+    bool Seeding = false;       // seeds from Sources at the boundary before the first frame
+    long long CaptureTime = 0;  // when the last frame was taken
+
+    bool FramePending = false;
+    int NextUnit = 0;
+    int UnitsPerFrame = 0;
+    float WorkCredit = 0;
+
+    bool PhaseLock = false;
+    bool StereoLink = false;
+    bool Linked = false;            // StereoLink as applied to the pending frame
+    std::valarray<int> LinkRef;     // channel each synthesis bin's trajectory follows
+    std::valarray<float> LinkMag;   // both channels' synthesis magnitudes, for peak picking
+
+    std::thread Worker;
+    std::mutex WorkerMutex;
+    std::condition_variable WorkerWake;
+    std::condition_variable WorkerDone;
+    int WorkerFirst = -1;       // units handed to the worker, -1 when idle
+    int WorkerLast = -1;
+    bool WorkerQuit = false;
+};
+
+//------------------------------------------------------------------------
+} // namespace tobyCorp
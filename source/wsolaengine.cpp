@@ -0,0 +1,321 @@
+//------------------------------------------------------------------------
+// Copyright(c) 2024 Toby Corp.
+//------------------------------------------------------------------------
+
+#include "wsolaengine.h"
+#include <algorithm>
+#include <math.h>
+
+namespace tobyCorp {
+
+//------------------------------------------------------------------------
+// WsolaEngine
+//------------------------------------------------------------------------
+void WsolaEngine::prepare(double sampleRate, int numChannels, float maxRatio, int minLatency)
+{
+    NumChannels = std::min(std::max(numChannels, 1), (int)kMaxChannels);
+
+    // 16ms grains hold at least one period of a low voice, the search covers +-4ms
+    GrainSize = 2 * (int)(0.008 * sampleRate);
+    HopSize = GrainSize / 2;
+    SearchRange = (int)(0.004 * sampleRate);
+    MatchSize = GrainSize / 4;
+
+    // the grain read position runs ahead of real time by up to GrainSize * (ratio - 1),
+    // and the splice search looks SearchRange + MatchSize samples forward
+    float ahead = std::max(GrainSize * (std::max(maxRatio, 1.f) - 1.f), (float)MatchSize);
+    Latency = SearchRange + (int)ceilf(ahead) + 1;
+    // reading further back in the history is all a longer latency takes
+    Latency = std::max(Latency, minLatency);
+
+    int needed = Latency + SearchRange + GrainSize * 2;
+    HistorySize = 1;
+    while (HistorySize < needed)
+        HistorySize <<= 1;
+
+    for (int ch = 0; ch < kMaxChannels; ch++)
+        History[ch].resize(HistorySize * 2);
+    MidHistory.resize(HistorySize * 2);
+    FollowHistory.resize(HistorySize);
+
+    // periodic Hann, two of them at 50% overlap add up to one
+    GWindow.resize(GrainSize);
+    for (int i = 0; i < GrainSize; i++)
+        GWindow[i] = .5f * (1.f - cosf(2.f * M_PI * i / (float)GrainSize));
+
+    reset();
+}
+
+//------------------------------------------------------------------------
+void WsolaEngine::reset()
+{
+    for (int ch = 0; ch < kMaxChannels; ch++)
+        History[ch] = 0.f;
+    MidHistory = 0.f;
+    FollowHistory = 0.f;
+    NextGrain = NumGrains = 0;
+    Now = 0;
+    FollowEnd = 0;
+    Following = Gradually = false;
+    FollowSteps = FollowingGrains = 0;
+}
+
+//------------------------------------------------------------------------
+void WsolaEngine::follow(float** target, int numChannels, int numSamples)
+{
+    numChannels = std::min(numChannels, NumChannels);
+    for (int i = 0; i < numSamples; i++)
+    {
+        float mid = 0;
+        for (int ch = 0; ch < numChannels; ch++)
+            mid += *(target[ch] + i);
+        FollowHistory[(int)(FollowEnd & (HistorySize - 1))] = mid / (float)numChannels;
+        FollowEnd++;
+    }
+}
+
+//------------------------------------------------------------------------
+void WsolaEngine::setFollowing(bool state, bool gradually)
+{
+    if (state && !Following)
+        Gradually = gradually;
+    Following = state;
+    if (!state)
+        FollowSteps = FollowingGrains = 0;
+}
+
+//------------------------------------------------------------------------
+bool WsolaEngine::isFollowing() const
+{
+    return Following && FollowingGrains >= 2;
+}
+
+//------------------------------------------------------------------------
+int WsolaEngine::getLatencySamples() const
+{
+    return Latency;
+}
+
+//------------------------------------------------------------------------
+float WsolaEngine::readHistory(const std::valarray<float>& history, double pos) const
+{
+    long long idx = (long long)floor(pos);
+    float frac = (float)(pos - (double)idx);
+    int i = (int)(idx & (HistorySize - 1));
+    return history[i] + frac * (history[i + 1] - history[i]);
+}
+
+//------------------------------------------------------------------------
+float WsolaEngine::similarity(const float* ref, const float* cand, int length, int stride)
+{
+    // four independent sums so the compiler can keep them in one vector register
+    float dot[4] = {0, 0, 0, 0};
+    float energy[4] = {0, 0, 0, 0};
+    int step = 4 * stride;
+    int i = 0;
+    for (; i + step <= length; i += step)
+    {
+        for (int k = 0; k < 4; k++)
+        {
+            float c = cand[i + k * stride];
+            dot[k] += ref[i + k * stride] * c;
+            energy[k] += c * c;
+        }
+    }
+    float d = dot[0] + dot[1] + dot[2] + dot[3];
+    float e = energy[0] + energy[1] + energy[2] + energy[3];
+    for (; i < length; i += stride)
+    {
+        d += ref[i] * cand[i];
+        e += cand[i] * cand[i];
+    }
+    return d / sqrtf(e + 1e-9f);
+}
+
+//------------------------------------------------------------------------
+long long WsolaEngine::findSplice(long long natural, long long nominal)
+{
+    const float* mid = &MidHistory[0];
+    const float* ref = mid + (natural & (HistorySize - 1));
+    long long first = nominal - SearchRange;
+
+    // coarse pass on every 4th offset with every 2nd sample, then refine around the winner.
+    // ties go to the nominal position, so silence and steady ratios don't drift the latency
+    int best = SearchRange;
+    float bestScore = similarity(ref, mid + (nominal & (HistorySize - 1)), MatchSize, 2);
+    for (int k = 0; k <= 2 * SearchRange; k += 4)
+    {
+        float score = similarity(ref, mid + ((first + k) & (HistorySize - 1)), MatchSize, 2);
+        if (score > bestScore)
+        {
+            bestScore = score;
+            best = k;
+        }
+    }
+
+    int from = std::max(best - 3, 0);
+    int to = std::min(best + 3, 2 * SearchRange);
+    bestScore = similarity(ref, mid + ((first + best) & (HistorySize - 1)), MatchSize, 1);
+    for (int k = from; k <= to; k++)
+    {
+        float score = similarity(ref, mid + ((first + k) & (HistorySize - 1)), MatchSize, 1);
+        if (score > bestScore)
+        {
+            bestScore = score;
+            best = k;
+        }
+    }
+    return first + best;
+}
+
+//------------------------------------------------------------------------
+// normalised correlation of the recorded output's last MatchSize samples up to end with the
+// input a grain starting now at start would have played over them
+float WsolaEngine::alignment(long long start, float pitchRatio, long long end) const
+{
+    float dot = 0;
+    float energy = 0;
+    for (int i = 0; i < MatchSize; i++)
+    {
+        long long t = end - MatchSize + i;
+        float ref = FollowHistory[(int)(t & (HistorySize - 1))];
+        float cand = readHistory(MidHistory, (double)start + (double)(t - Now) * pitchRatio);
+        dot += ref * cand;
+        energy += cand * cand;
+    }
+    return dot / sqrtf(energy + 1e-9f);
+}
+
+//------------------------------------------------------------------------
+long long WsolaEngine::findAlignment(long long nominal, float pitchRatio, long long end, const long long* natural, bool& aligned)
+{
+    // the same coarse and fine passes as findSplice, ties go to the nominal position. Given the
+    // natural continuation of the last grain, only starts that splice to it nearly as well as
+    // the best splice are taken
+    const float* mid = &MidHistory[0];
+    const float* ref = natural ? mid + (*natural & (HistorySize - 1)) : nullptr;
+    float floor = 0;
+    long long first = nominal - SearchRange;
+    int best = SearchRange;
+    if (natural)
+    {
+        best = (int)(findSplice(*natural, nominal) - first);
+        floor = kSpliceFloor * similarity(ref, mid + ((first + best) & (HistorySize - 1)), MatchSize, 1);
+    }
+
+    float bestScore = alignment(first + best, pitchRatio, end);
+    float freeScore = bestScore;
+    for (int k = 0; k <= 2 * SearchRange; k += 4)
+    {
+        float score = alignment(first + k, pitchRatio, end);
+        freeScore = std::max(freeScore, score);
+        if (score > bestScore
+            && (!natural || similarity(ref, mid + ((first + k) & (HistorySize - 1)), MatchSize, 1) >= floor))
+        {
+            bestScore = score;
+            best = k;
+        }
+    }
+    aligned = bestScore >= freeScore;
+
+    int from = std::max(best - 3, 0);
+    int to = std::min(best + 3, 2 * SearchRange);
+    for (int k = from; k <= to; k++)
+    {
+        float score = alignment(first + k, pitchRatio, end);
+        if (score > bestScore
+            && (!natural || similarity(ref, mid + ((first + k) & (HistorySize - 1)), MatchSize, 1) >= floor))
+        {
+            bestScore = score;
+            best = k;
+        }
+    }
+    return first + best;
+}
+
+//------------------------------------------------------------------------
+void WsolaEngine::startGrain(float pitchRatio)
+{
+    long long nominal = Now - Latency;
+    long long start = nominal;
+    const Grain& prev = Grains[(NextGrain + 1) & 1];
+    // the recording may end up to a hop before the grain, further back the history runs out
+    // at the highest ratio
+    long long end = std::min(FollowEnd, Now);
+    bool follow = Following && end >= MatchSize && Now - end <= HopSize;
+    // after feed() the last grain may be long over, then there is nothing to splice to
+    bool splice = NumGrains > 0 && Now - prev.OutStart < GrainSize;
+    long long natural = prev.InStart + (long long)llroundf((float)HopSize * prev.Ratio);
+    bool aligned = false;
+    if (follow)
+    {
+        bool step = splice && Gradually && FollowSteps < kMaxFollowSteps;
+        start = findAlignment(nominal, pitchRatio, end, step ? &natural : nullptr, aligned);
+    }
+    else if (splice)
+        start = findSplice(natural, nominal);
+
+    FollowSteps = follow ? FollowSteps + 1 : 0;
+    FollowingGrains = follow && aligned ? FollowingGrains + 1 : 0;
+
+    Grain& g = Grains[NextGrain];
+    g.InStart = start;
+    g.OutStart = Now;
+    g.Ratio = pitchRatio;
+    NextGrain = (NextGrain + 1) & 1;
+    NumGrains = std::min(NumGrains + 1, 2);
+}
+
+//------------------------------------------------------------------------
+void WsolaEngine::process(float** in, float** out, int numChannels, int numSamples, float pitchRatio)
+{
+    run(in, out, numChannels, numSamples, pitchRatio, true);
+}
+
+//------------------------------------------------------------------------
+void WsolaEngine::feed(float** in, float** out, int numChannels, int numSamples)
+{
+    run(in, out, numChannels, numSamples, 1.f, false);
+}
+
+//------------------------------------------------------------------------
+void WsolaEngine::run(float** in, float** out, int numChannels, int numSamples, float pitchRatio, bool startGrains)
+{
+    numChannels = std::min(numChannels, NumChannels);
+
+    for (int i = 0; i < numSamples; i++)
+    {
+        // read all inputs first, the host may process in place
+        int idx = (int)(Now & (HistorySize - 1));
+        float mid = 0;
+        for (int ch = 0; ch < numChannels; ch++)
+        {
+            float x = *(in[ch] + i);
+            History[ch][idx] = History[ch][idx + HistorySize] = x;
+            mid += x;
+        }
+        mid /= (float)numChannels;
+        MidHistory[idx] = MidHistory[idx + HistorySize] = mid;
+
+        if (startGrains && (NumGrains == 0 || Now - Grains[(NextGrain + 1) & 1].OutStart >= HopSize))
+            startGrain(pitchRatio);
+
+        for (int ch = 0; out && ch < numChannels; ch++)
+        {
+            float y = 0;
+            for (int g = 0; g < NumGrains; g++)
+            {
+                const Grain& grain = Grains[g];
+                long long t = Now - grain.OutStart;
+                if (t >= GrainSize)
+                    continue;
+                y += GWindow[t] * readHistory(History[ch], (double)grain.InStart + (double)t * grain.Ratio);
+            }
+            *(out[ch] + i) = y;
+        }
+        Now++;
+    }
+}
+
+//------------------------------------------------------------------------
+} // namespace tobyCorp
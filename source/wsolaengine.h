@@ -0,0 +1,97 @@
+//------------------------------------------------------------------------
+// Copyright(c) 2024 Toby Corp.
+//------------------------------------------------------------------------
+
+#pragma once
+
+#include <valarray>
+
+namespace tobyCorp {
+
+//------------------------------------------------------------------------
+//  WsolaEngine
+//
+//  Time-domain pitch shifter for monophonic material and small shifts.
+//  Output is built from Hann grains with 50% overlap, each one reading the
+//  input at pitchRatio speed. Every grain start is moved by up to
+//  SearchRange samples to where the input looks most like the natural
+//  continuation of the previous grain (WSOLA), so the splices stay in
+//  phase with the waveform. The search runs once on the mid signal, both
+//  channels use the same splice points.
+//
+//  While another renderer is crossfaded against it, the grains can follow
+//  that renderer's output instead of the last grain, so the two don't
+//  cancel each other in the crossfade.
+//------------------------------------------------------------------------
+class WsolaEngine
+{
+public:
+    static const int kMaxChannels = 2;
+
+    /** Allocates all buffers, must not be called from the audio thread.
+        The output is delayed further when needed to reach minLatency. */
+    void prepare(double sampleRate, int numChannels, float maxRatio, int minLatency = 0);
+    /** Clears the signal history without reallocating. */
+    void reset();
+    /** in and out may point to the same buffers. */
+    void process(float** in, float** out, int numChannels, int numSamples, float pitchRatio);
+    /** Keeps the history running without starting grains, the ones playing still play out to
+        out, which may be nullptr. The next process() call starts from a full history. */
+    void feed(float** in, float** out, int numChannels, int numSamples);
+    /** Records another renderer's output, numSamples at a time from the first sample this engine
+        was fed or processed after reset, for setFollowing. May run ahead of process() by a block. */
+    void follow(float** target, int numChannels, int numSamples);
+    /** On, each grain starts where its input, read at the grain's speed, best matches the
+        recorded output just before the grain, so it plays in phase with that renderer. While
+        this engine is heard, gradually turns towards it in steps the splices hide, a grain out
+        of phase with the last one cancels it where they overlap. */
+    void setFollowing(bool state, bool gradually = false);
+    /** Both grains playing were started in phase with the recorded output. */
+    bool isFollowing() const;
+    int getLatencySamples() const;
+
+protected:
+    struct Grain
+    {
+        long long InStart = 0;  // input position of the first grain sample
+        long long OutStart = 0; // time the grain started playing
+        float Ratio = 1;
+    };
+
+    void run(float** in, float** out, int numChannels, int numSamples, float pitchRatio, bool startGrains);
+    void startGrain(float pitchRatio);
+    long long findSplice(long long natural, long long nominal);
+    long long findAlignment(long long nominal, float pitchRatio, long long end, const long long* natural, bool& aligned);
+    float alignment(long long start, float pitchRatio, long long end) const;
+    float similarity(const float* ref, const float* cand, int length, int stride);
+    float readHistory(const std::valarray<float>& history, double pos) const;
+
+    std::valarray<float> History[kMaxChannels];  // mirrored rings, so any HistorySize run is contiguous
+    std::valarray<float> MidHistory;
+    std::valarray<float> FollowHistory;     // mid of the recorded output, a ring of HistorySize
+    std::valarray<float> GWindow;
+
+    int HistorySize = 4096;
+    int GrainSize = 768;
+    int HopSize = 384;
+    int SearchRange = 192;
+    int MatchSize = 192;
+    int Latency = 0;
+    int NumChannels = 2;
+
+    Grain Grains[2];
+    int NextGrain = 0;
+    int NumGrains = 0;
+    long long Now = 0;      // number of input samples written so far
+
+    long long FollowEnd = 0;    // number of output samples recorded so far
+    bool Following = false;
+    bool Gradually = false;
+    int FollowSteps = 0;        // grains started since following was turned on
+    int FollowingGrains = 0;    // grains started in a row in phase with the recording
+    static const int kMaxFollowSteps = 8;       // then the grains jump to the recording's phase
+    static constexpr float kSpliceFloor = .7f;  // a 45 degree step on a sine, -0.7dB in the overlap
+};
+
+//------------------------------------------------------------------------
+} // namespace tobyCorp
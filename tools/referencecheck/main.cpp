@@ -0,0 +1,459 @@
+//------------------------------------------------------------------------
+// Copyright(c) 2024 Toby Corp.
+//------------------------------------------------------------------------
+
+//  Runs every build option of SpectralEngine next to the frozen reference
+//  vocoder over a grid of signals, pitch ratios, FFT sizes and host block
+//  sizes, and checks SNR, log-spectral distance and max sample error
+//  against thresholds, the pitch of steady tones, and with stereo link
+//  the phase between the channels against the input's. Then switches
+//  between the CPU governor's levels on steady tones and checks the
+//  switches for holes. Exits with 1 when any case fails.
+//
+//  usage: FFTPitchShiftReferenceCheck [-v] [recording.wav ...]
+
+#include "referencevocoder.h"
+#include "signalmetrics.h"
+#include "transitioncheck.h"
+#include "multiresengine.h"
+#include "spectralengine.h"
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+using namespace tobyCorp;
+using namespace tobyCorp::reference;
+
+static const double kSampleRate = 48000;
+static const int kSignalLength = 48000;
+
+//------------------------------------------------------------------------
+//  Build options of the engine. Exact ones must match the reference up
+//  to rounding, approximate ones change the result on purpose and are
+//  held to their own log-spectral distance, a little over the worst case
+//  measured, and to the pitch of steady tones. Sparse runs the bin range and
+//  quiet bin paths the multi-resolution engine uses, MultiRes runs that
+//  engine itself, with its own FFT sizes and crossover.
+//------------------------------------------------------------------------
+struct Variant
+{
+    const char* Name;
+    bool Exact;
+    float MaxLogSpectralDb;
+    bool SpreadLoad;
+    bool PhaseLock;
+    bool Threaded;
+    bool StereoLink;
+    bool Sparse;
+    bool MultiRes;
+};
+
+static const Variant kVariants[] = {
+    {"burst",         true,  0.5f, false, false, false, false, false, false},
+    {"spread",        true,  0.5f, true,  false, false, false, false, false},
+    {"threaded",      true,  0.5f, false, false, true,  false, false, false},
+    {"phase lock",    false, 8.f,  false, true,  false, false, false, false},
+    {"linked",        false, 8.f,  true,  false, false, true,  false, false},
+    {"linked mt",     false, 8.f,  false, true,  true,  true,  false, false},
+    {"sparse",        false, 3.5f, true,  false, false, false, true,  false},
+    {"sparse linked", false, 8.f,  true,  false, false, true,  true,  false},
+    {"multi-res",     false, 3.5f, true,  false, false, false, false, true},
+};
+
+struct Thresholds
+{
+    float MinSnrDb;
+    float MaxError;
+};
+
+// exact builds only differ from the reference by rounding, since the phase constants are
+// precomputed; the worst case is 59.7dB on the click train, whose power is tiny next to the
+// accumulated phase rounding
+static const Thresholds kExact = {57.f, 1e-3f};
+static const Thresholds kApproximate = {-1e9f, 1e9f};
+// the log-spectral distance of the approximate builds is worst on white noise, where bin
+// magnitudes of two equally loud noises with different phases are already ~7.5dB apart, so it
+// can't tell a wrong pitch from a right one on its own: a reference that doesn't shift the
+// harmonic tone scores less than that. Steady tones are also held to the pitch of their
+// strongest partial where the FFT resolves the partials: every build is within 2 cents of
+// it, a semitone sharp reference no closer than 98
+static const float kMaxPitchErrorCents = 5.f;
+// the pitch check must fail a reference rendered a semitone sharp, or it checks nothing
+static const float kControlCents = 100.f;
+// stereo link keeps the phase offset between the channels of each partial, on signals whose
+// channels share their partials; the worst case measured is 0.27 radians, the unlinked builds
+// drift 1.1 to 2.9 radians apart
+static const float kMaxLinkedPhaseError = 0.35f;
+
+// a ratio of kGlide glides up an octave over the signal, from 0.75 to 1.5, set once per block
+// like pitch automation, so the engine's bin remap table is rebuilt on every frame that moves
+static const float kGlide = 0.f;
+
+static float blockRatio(float ratio, size_t pos, size_t length)
+{
+    if (ratio != kGlide)
+        return ratio;
+    return 0.75f * powf(2.f, (float)pos / (float)length);
+}
+
+struct Signal
+{
+    std::string Name;
+    std::vector<float> Channels[2];
+    bool CheckStereo = false;   // the channels share partials, so their phase offset is checked
+    float PartialSpacing = 0;   // Hz between steady partials, so the pitch of the output is checked
+};
+
+//------------------------------------------------------------------------
+static void makeSignals(std::vector<Signal>& signals)
+{
+    unsigned int seed = 12345;
+    auto noise = [&seed]() {
+        seed = seed * 1664525u + 1013904223u;
+        return (float)(seed >> 8) / (float)(1 << 24) * 2.f - 1.f;
+    };
+
+    Signal sweep{"sweep"};
+    Signal tone{"harmonic tone"};
+    Signal stereo{"stereo tone"};
+    Signal white{"noise"};
+    Signal clicks{"transients"};
+    for (Signal* s : {&sweep, &tone, &stereo, &white, &clicks})
+        for (auto& c : s->Channels)
+            c.resize(kSignalLength);
+
+    double phase = 0;
+    for (int i = 0; i < kSignalLength; i++)
+    {
+        double t = i / kSampleRate;
+
+        // exponential sweep from 50Hz to 10kHz in a second, the right channel a quarter period behind
+        double f = 50.0 * pow(200.0, (double)i / kSignalLength);
+        phase += 2.0 * M_PI * f / kSampleRate;
+        sweep.Channels[0][i] = 0.5f * (float)sin(phase);
+        sweep.Channels[1][i] = 0.5f * (float)cos(phase);
+
+        // 10 harmonics of 220Hz in the left channel, of 330Hz in the right one
+        float l = 0, r = 0;
+        for (int h = 1; h <= 10; h++)
+        {
+            l += (float)sin(2.0 * M_PI * 220.0 * h * t) / h;
+            r += (float)sin(2.0 * M_PI * 330.0 * h * t + h) / h;
+        }
+        tone.Channels[0][i] = 0.2f * l;
+        tone.Channels[1][i] = 0.2f * r;
+
+        // the same 10 harmonics of 196Hz in both channels, each one offset and quieter on the right
+        l = r = 0;
+        for (int h = 1; h <= 10; h++)
+        {
+            l += (float)sin(2.0 * M_PI * 196.0 * h * t) / h;
+            r += 0.6f * (float)sin(2.0 * M_PI * 196.0 * h * t + 0.7 * h) / h;
+        }
+        stereo.Channels[0][i] = 0.2f * l;
+        stereo.Channels[1][i] = 0.2f * r;
+
+        white.Channels[0][i] = 0.3f * noise();
+        white.Channels[1][i] = 0.3f * noise();
+
+        // a decaying 1kHz burst every 100ms and a single sample click every 170ms
+        int burst = i % 4800;
+        clicks.Channels[0][i] = 0.5f * expf(-burst / 200.f) * (float)sin(2.0 * M_PI * 1000.0 * burst / kSampleRate);
+        clicks.Channels[1][i] = i % 8160 == 0 ? 0.8f : 0.f;
+    }
+    sweep.CheckStereo = true;
+    stereo.CheckStereo = true;
+    tone.PartialSpacing = 220.f;
+    stereo.PartialSpacing = 196.f;
+    signals.push_back(sweep);
+    signals.push_back(tone);
+    signals.push_back(stereo);
+    signals.push_back(white);
+    signals.push_back(clicks);
+}
+
+//------------------------------------------------------------------------
+// a partial's main lobe is four bins wide, closer partials blur into each other and no build
+// gets their pitch right, a downward shift moves them closer
+static bool checksPitch(const Signal& s, int fftSize, float ratio)
+{
+    float binWidth = (float)kSampleRate / (float)fftSize;
+    return s.PartialSpacing > 0 && ratio != kGlide && s.PartialSpacing * std::min(ratio, 1.f) >= 4.f * binWidth;
+}
+
+//------------------------------------------------------------------------
+static void runReference(const Signal& s, int fftSize, int overlap, int blockSize, float ratio,
+                         std::vector<float> out[2], int& latency)
+{
+    ReferenceVocoder vocoder;
+    vocoder.prepare(fftSize, overlap, 2);
+    latency = vocoder.getLatencySamples();
+
+    size_t length = s.Channels[0].size();
+    out[0].assign(length, 0.f);
+    out[1].assign(length, 0.f);
+    for (size_t pos = 0; pos < length; pos += blockSize)
+    {
+        int n = (int)std::min((size_t)blockSize, length - pos);
+        float* in[2] = {const_cast<float*>(s.Channels[0].data()) + pos, const_cast<float*>(s.Channels[1].data()) + pos};
+        float* o[2] = {out[0].data() + pos, out[1].data() + pos};
+        vocoder.process(in, o, 2, n, blockRatio(ratio, pos, length));
+    }
+}
+
+//------------------------------------------------------------------------
+template <class Engine>
+static void runBlocks(Engine& engine, const Signal& s, int blockSize, float ratio, std::vector<float> out[2])
+{
+    size_t length = s.Channels[0].size();
+    out[0].assign(length, 0.f);
+    out[1].assign(length, 0.f);
+    for (size_t pos = 0; pos < length; pos += blockSize)
+    {
+        int n = (int)std::min((size_t)blockSize, length - pos);
+        float* in[2] = {const_cast<float*>(s.Channels[0].data()) + pos, const_cast<float*>(s.Channels[1].data()) + pos};
+        float* o[2] = {out[0].data() + pos, out[1].data() + pos};
+        engine.process(in, o, 2, n, blockRatio(ratio, pos, length));
+    }
+}
+
+//------------------------------------------------------------------------
+static void runEngine(const Signal& s, const Variant& v, int fftSize, int overlap, int blockSize, float ratio,
+                      std::vector<float> out[2], int& latency)
+{
+    if (v.MultiRes)
+    {
+        MultiResEngine engine;
+        engine.prepare(kSampleRate, 2, v.SpreadLoad);
+        engine.setPhaseLock(v.PhaseLock);
+        engine.setMultiThreaded(v.Threaded);
+        engine.setStereoLink(v.StereoLink);
+        latency = engine.getLatencySamples();
+        runBlocks(engine, s, blockSize, ratio, out);
+        return;
+    }
+
+    SpectralEngine engine;
+    engine.prepare(fftSize, overlap, 2, v.SpreadLoad);
+    engine.setPhaseLock(v.PhaseLock);
+    engine.setMultiThreaded(v.Threaded);
+    engine.setStereoLink(v.StereoLink);
+    if (v.Sparse)
+    {
+        // drops DC and the top bin, and skips the quiet upper half like the high band does
+        engine.setBinRange(1, fftSize / 2 - 1);
+        engine.setSkipQuietBins(fftSize / 4, MultiResEngine::kSkipFloor);
+    }
+    latency = engine.getLatencySamples();
+    runBlocks(engine, s, blockSize, ratio, out);
+}
+
+//------------------------------------------------------------------------
+// drops each signal's own latency so sample i of both is the same input time
+static void align(const std::vector<float>& a, int latencyA, const std::vector<float>& b, int latencyB,
+                  std::vector<float>& outA, std::vector<float>& outB)
+{
+    size_t length = std::min(a.size() - latencyA, b.size() - latencyB);
+    outA.assign(a.begin() + latencyA, a.begin() + latencyA + length);
+    outB.assign(b.begin() + latencyB, b.begin() + latencyB + length);
+}
+
+//------------------------------------------------------------------------
+struct Summary
+{
+    int Cases = 0;
+    int Failures = 0;
+    float WorstSnrDb = 1e9f;
+    float WorstLogSpectralDb = 0;
+    float WorstMaxError = 0;
+    float WorstPhaseError = 0;
+    float WorstPitchErrorCents = 0;
+};
+
+//------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+    bool verbose = false;
+    std::vector<Signal> signals;
+    makeSignals(signals);
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-v") == 0)
+        {
+            verbose = true;
+            continue;
+        }
+
+        Signal s{argv[i]};
+        std::vector<std::vector<float>> channels;
+        double sampleRate = 0;
+        if (!readWav(argv[i], channels, sampleRate))
+        {
+            fprintf(stderr, "can't read %s, only 16-bit PCM and 32-bit float WAV files are supported\n", argv[i]);
+            return 2;
+        }
+        s.Channels[0] = channels[0];
+        s.Channels[1] = channels.size() > 1 ? channels[1] : channels[0];
+        signals.push_back(s);
+    }
+
+    const float ratios[] = {0.5f, 0.89f, 1.f, 1.06f, 2.f, kGlide};
+    const int fftSizes[] = {512, 1024, 2048};
+    const int overlaps[] = {2, 4, 8};
+    const int blockSizes[] = {32, 100, 1024};
+
+    const int numBlockSizes = sizeof(blockSizes) / sizeof(blockSizes[0]);
+    const int numVariants = sizeof(kVariants) / sizeof(kVariants[0]);
+    Summary summaries[numVariants];
+    Summary control;
+
+    for (const Signal& s : signals)
+    for (int fftSize : fftSizes)
+    for (int overlap : overlaps)
+    for (float ratio : ratios)
+    {
+        // a glide sets the ratio per block, so its reference depends on the block size
+        std::vector<float> reference[numBlockSizes][2];
+        int referenceLatency = 0;
+        for (int block = 0; block < numBlockSizes; block++)
+        {
+            if (ratio != kGlide && block > 0)
+            {
+                reference[block][0] = reference[0][0];
+                reference[block][1] = reference[0][1];
+                continue;
+            }
+            int referenceBlock = ratio == kGlide ? blockSizes[block] : (int)s.Channels[0].size();
+            runReference(s, fftSize, overlap, referenceBlock, ratio, reference[block], referenceLatency);
+        }
+
+        char ratioName[16];
+        snprintf(ratioName, sizeof(ratioName), ratio == kGlide ? "glide" : "%.2f", ratio);
+
+        if (checksPitch(s, fftSize, ratio))
+        {
+            float sharp = ratio * powf(2.f, kControlCents / 1200.f);
+            std::vector<float> wrong[2];
+            int wrongLatency = 0;
+            runReference(s, fftSize, overlap, (int)s.Channels[0].size(), sharp, wrong, wrongLatency);
+            for (int ch = 0; ch < 2; ch++)
+            {
+                std::vector<float> a, b;
+                align(reference[0][ch], referenceLatency, wrong[ch], wrongLatency, a, b);
+                float lsd = compareSignals(a, b).LogSpectralDb;
+                align(s.Channels[ch], 0, wrong[ch], wrongLatency, a, b);
+                float cents = pitchErrorCents(a, b, ratio);
+                bool pass = cents > kMaxPitchErrorCents;
+
+                control.Cases++;
+                control.Failures += pass ? 0 : 1;
+                control.WorstPitchErrorCents = control.Cases == 1 ? cents : std::min(control.WorstPitchErrorCents, cents);
+                control.WorstLogSpectralDb = control.Cases == 1 ? lsd : std::min(control.WorstLogSpectralDb, lsd);
+
+                if (verbose || !pass)
+                {
+                    printf("%-4s %-14s %-16s fft %4d x%d            ratio %-5s ch %d: lsd %6.2fdB pitch %6.1f cents\n",
+                        pass ? "ok" : "FAIL", "control", s.Name.c_str(), fftSize, overlap, ratioName, ch, lsd, cents);
+                }
+            }
+        }
+
+        for (int v = 0; v < numVariants; v++)
+        for (int block = 0; block < numBlockSizes; block++)
+        {
+            int blockSize = blockSizes[block];
+            const Variant& variant = kVariants[v];
+            // the multi-resolution engine has its own FFT sizes, it is compared once, against the
+            // plugin's default ones
+            if (variant.MultiRes && (fftSize != 1024 || overlap != 4))
+                continue;
+            const Thresholds& limits = variant.Exact ? kExact : kApproximate;
+
+            std::vector<float> out[2];
+            int latency = 0;
+            runEngine(s, variant, fftSize, overlap, blockSize, ratio, out, latency);
+
+            Summary& sum = summaries[v];
+            if (s.CheckStereo && ratio != kGlide)
+            {
+                std::vector<float> inL, inR, outL, outR;
+                align(s.Channels[0], 0, out[0], latency, inL, outL);
+                align(s.Channels[1], 0, out[1], latency, inR, outR);
+                float error = interChannelPhaseError(inL, inR, outL, outR, ratio);
+                bool pass = !variant.StereoLink || error <= kMaxLinkedPhaseError;
+
+                sum.Cases++;
+                sum.Failures += pass ? 0 : 1;
+                sum.WorstPhaseError = std::max(sum.WorstPhaseError, error);
+
+                if (verbose || !pass)
+                {
+                    printf("%-4s %-14s %-16s fft %4d x%d block %4d ratio %-5s    : inter-channel phase %.3f\n",
+                        pass ? "ok" : "FAIL", variant.Name, s.Name.c_str(), fftSize, overlap, blockSize, ratioName, error);
+                }
+            }
+
+            for (int ch = 0; ch < 2; ch++)
+            {
+                std::vector<float> a, b;
+                align(reference[block][ch], referenceLatency, out[ch], latency, a, b);
+                SignalMetrics m = compareSignals(a, b);
+
+                bool pass = m.SnrDb >= limits.MinSnrDb && m.LogSpectralDb <= variant.MaxLogSpectralDb
+                    && m.MaxError <= limits.MaxError;
+
+                sum.Cases++;
+                sum.Failures += pass ? 0 : 1;
+                sum.WorstSnrDb = std::min(sum.WorstSnrDb, m.SnrDb);
+                sum.WorstLogSpectralDb = std::max(sum.WorstLogSpectralDb, m.LogSpectralDb);
+                sum.WorstMaxError = std::max(sum.WorstMaxError, m.MaxError);
+
+                if (verbose || !pass)
+                {
+                    printf("%-4s %-14s %-16s fft %4d x%d block %4d ratio %-5s ch %d: snr %7.1fdB lsd %6.2fdB max %.2e\n",
+                        pass ? "ok" : "FAIL", variant.Name, s.Name.c_str(), fftSize, overlap, blockSize, ratioName, ch,
+                        m.SnrDb, m.LogSpectralDb, m.MaxError);
+                }
+
+                if (checksPitch(s, fftSize, ratio))
+                {
+                    align(s.Channels[ch], 0, out[ch], latency, a, b);
+                    float cents = pitchErrorCents(a, b, ratio);
+                    pass = cents <= kMaxPitchErrorCents;
+
+                    sum.Cases++;
+                    sum.Failures += pass ? 0 : 1;
+                    sum.WorstPitchErrorCents = std::max(sum.WorstPitchErrorCents, cents);
+
+                    if (verbose || !pass)
+                    {
+                        printf("%-4s %-14s %-16s fft %4d x%d block %4d ratio %-5s ch %d: pitch %.1f cents\n",
+                            pass ? "ok" : "FAIL", variant.Name, s.Name.c_str(), fftSize, overlap, blockSize, ratioName, ch,
+                            cents);
+                    }
+                }
+            }
+        }
+    }
+
+    printf("\n%-14s %-6s %6s %6s %10s %10s %10s %10s %10s\n", "variant", "kind", "cases", "failed", "min snr", "max lsd",
+        "max error", "max phase", "max pitch");
+    int failures = 0;
+    for (int v = 0; v < numVariants; v++)
+    {
+        const Summary& sum = summaries[v];
+        printf("%-14s %-6s %6d %6d %8.1fdB %8.2fdB %10.2e %10.3f %6.1fcent\n", kVariants[v].Name,
+            kVariants[v].Exact ? "exact" : "approx", sum.Cases, sum.Failures, sum.WorstSnrDb, sum.WorstLogSpectralDb,
+            sum.WorstMaxError, sum.WorstPhaseError, sum.WorstPitchErrorCents);
+        failures += sum.Failures;
+    }
+    // the control's columns are its best case, the closest a semitone sharp reference comes
+    printf("%-14s %-6s %6d %6d %10s %8.2fdB %10s %10s %6.1fcent\n", "control", "sharp", control.Cases, control.Failures,
+        "", control.WorstLogSpectralDb, "", "", control.WorstPitchErrorCents);
+    failures += control.Failures;
+    failures += checkTransitions(verbose);
+    printf("\n%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,223 @@
+//------------------------------------------------------------------------
+// Copyright(c) 2024 Toby Corp.
+//------------------------------------------------------------------------
+
+#include "referencevocoder.h"
+#include <algorithm>
+#include <math.h>
+
+namespace tobyCorp {
+namespace reference {
+
+//------------------------------------------------------------------------
+float wrapPhase(float phaseIn)
+{
+    if (phaseIn >= 0)
+        return fmodf(phaseIn + M_PI, 2.0 * M_PI) - M_PI;
+    else
+        return fmodf(phaseIn - M_PI, -2.0 * M_PI) + M_PI;
+}
+
+//code obtained from this article https://rosettacode.org/wiki/Fast_Fourier_transform#C++
+void fft(CArray &x)
+{
+        // DFT
+        unsigned int N = (unsigned int)x.size(), k = N, n;
+        double thetaT = M_PI / N;
+        Complex phiT = Complex(cos(thetaT), -sin(thetaT)), T;
+        while (k > 1)
+        {
+            n = k;
+            k >>= 1;
+            phiT = phiT * phiT;
+            T = 1.0L;
+            for (unsigned int l = 0; l < k; l++)
+            {
+                for (unsigned int a = l; a < N; a += n)
+                {
+                    unsigned int b = a + k;
+                    Complex t = x[a] - x[b];
+                    x[a] += x[b];
+                    x[b] = t * T;
+                }
+                T *= phiT;
+            }
+        }
+
+        // Decimate
+        unsigned int m = (unsigned int)log2(N);
+        for (unsigned int a = 0; a < N; a++)
+        {
+            unsigned int b = a;
+            // Reverse bits
+            b = (((b & 0xaaaaaaaa) >> 1) | ((b & 0x55555555) << 1));
+            b = (((b & 0xcccccccc) >> 2) | ((b & 0x33333333) << 2));
+            b = (((b & 0xf0f0f0f0) >> 4) | ((b & 0x0f0f0f0f) << 4));
+            b = (((b & 0xff00ff00) >> 8) | ((b & 0x00ff00ff) << 8));
+            b = ((b >> 16) | (b << 16)) >> (32 - m);
+            if (b > a)
+            {
+                Complex t = x[a];
+                x[a] = x[b];
+                x[b] = t;
+            }
+        }
+}
+
+void ifft(CArray &x)
+{
+    // conjugate the complex numbers
+        x = x.apply(std::conj);
+
+        // forward fft
+        fft(x);
+
+        // conjugate the complex numbers again
+        x = x.apply(std::conj);
+
+        // scale the numbers
+        x /= x.size();
+}
+
+// methodology is from this tutorial video
+// https://youtu.be/2p_-jbl6Dyc?si=85sU6lSs_YuvOVyH&t=1741
+void ReferenceVocoder::processFFT(CArray &x, Channel &c)
+{
+    for (size_t i = 0; i < FFTSize / 2; i++)
+        {
+            float amplitude = std::abs(x[i]);
+            float phase = std::arg(x[i]);
+
+            float phaseDiff = phase - c.LastInputPhases[i];
+
+            float binCentreFrequency = 2.f * M_PI * (float)i / (float)FFTSize;
+            phaseDiff = wrapPhase(phaseDiff - binCentreFrequency * (float)HopSize);
+
+            float binDeviation = phaseDiff * (float)FFTSize / (float)HopSize / (2.f * M_PI);
+            c.AnalysisFreq[i] = (float)i + binDeviation;
+            c.AnalysisMag[i] = amplitude;
+
+            c.LastInputPhases[i] = phase;
+        }
+
+    for (size_t i = 0; i < FFTSize / 2; i++)
+        {
+            c.SynthMag[i] = c.SynthFreq[i] = 0;
+        }
+
+        for (size_t i = 0; i < FFTSize / 2; i++)
+        {
+            int newBin = floorf(i * fPitchRatio + .5);
+
+            if (newBin <= FFTSize / 2)
+            {
+                c.SynthMag[newBin] += c.AnalysisMag[i];
+                c.SynthFreq[newBin] = c.AnalysisFreq[i] * fPitchRatio;
+            }
+        }
+
+        for (size_t i = 0; i < FFTSize / 2; i++)
+        {
+            float amplitude = c.SynthMag[i];
+
+            float binDeviation = c.SynthFreq[i] - i;
+
+            float phaseDiff = binDeviation * 2.f * M_PI * (float)HopSize / (float)FFTSize;
+
+            float binCentreFrequency = 2.f * M_PI * (float)i / (float)FFTSize;
+            phaseDiff += binCentreFrequency * (float)HopSize;
+
+            float outPhase = wrapPhase(c.LastOutputPhases[i] + phaseDiff);
+
+            x[i].real(amplitude * cosf(outPhase));
+            x[i].imag(amplitude * sinf(outPhase));
+
+            if (i > 0 && i < FFTSize / 2)
+            {
+                x[FFTSize - i].real(x[i].real());
+                x[FFTSize - i].imag(-1.f * x[i].imag());
+            }
+            c.LastOutputPhases[i] = outPhase;
+        }
+}
+
+//------------------------------------------------------------------------
+// ReferenceVocoder
+//------------------------------------------------------------------------
+void ReferenceVocoder::prepare(int fftSize, int overlap, int numChannels)
+{
+    FFTSize = fftSize;
+    HopSize = fftSize / overlap;
+    NumChannels = std::min(std::max(numChannels, 1), (int)kMaxChannels);
+    HopCounter = Pos = 0;
+
+    // same window and gain as SpectralEngine
+    OutputGain = overlap == 2 ? 1.f : 1.f / (0.375f * (float)overlap);
+    HWindow.resize(FFTSize);
+    for (int i = 0; i < FFTSize; i++)
+    {
+        HWindow[i] = .5f * (1.f - cosf(2.f * M_PI * i / (float)FFTSize));
+        if (overlap == 2)
+            HWindow[i] = sqrtf(HWindow[i]);
+    }
+
+    for (int ch = 0; ch < kMaxChannels; ch++)
+    {
+        Channel& c = Channels[ch];
+        c.InFifo.resize(FFTSize);
+        c.OutAccum.resize(FFTSize);
+        c.Frame.resize(FFTSize);
+        c.LastInputPhases.resize(FFTSize);
+        c.LastOutputPhases.resize(FFTSize);
+        c.AnalysisMag.resize(FFTSize);
+        c.AnalysisFreq.resize(FFTSize);
+        c.SynthMag.resize(FFTSize);
+        c.SynthFreq.resize(FFTSize);
+        c.InFifo = 0.f;
+        c.OutAccum = 0.f;
+        c.LastInputPhases = 0.f;
+        c.LastOutputPhases = 0.f;
+    }
+}
+
+//------------------------------------------------------------------------
+void ReferenceVocoder::process(float** in, float** out, int numChannels, int numSamples, float pitchRatio)
+{
+    numChannels = std::min(numChannels, NumChannels);
+    for (int i = 0; i < numSamples; i++)
+    {
+        for (int ch = 0; ch < numChannels; ch++)
+        {
+            Channel& c = Channels[ch];
+            float x = in[ch][i];
+            out[ch][i] = c.OutAccum[Pos];
+            c.OutAccum[Pos] = 0;
+            c.InFifo[Pos] = x;
+        }
+        Pos = (Pos + 1) % FFTSize;
+
+        if (++HopCounter < HopSize)
+            continue;
+        HopCounter = 0;
+
+        // Pos is now the oldest input sample and the next output sample
+        fPitchRatio = pitchRatio;
+        for (int ch = 0; ch < numChannels; ch++)
+        {
+            Channel& c = Channels[ch];
+            for (int k = 0; k < FFTSize; k++)
+                c.Frame[k] = c.InFifo[(Pos + k) % FFTSize] * HWindow[k];
+
+            fft(c.Frame);
+            processFFT(c.Frame, c);
+            ifft(c.Frame);
+
+            for (int k = 0; k < FFTSize; k++)
+                c.OutAccum[(Pos + k) % FFTSize] += c.Frame[k].real() * HWindow[k] * OutputGain;
+        }
+    }
+}
+
+//------------------------------------------------------------------------
+} // namespace reference
+} // namespace tobyCorp
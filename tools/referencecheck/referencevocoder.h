@@ -0,0 +1,72 @@
+//------------------------------------------------------------------------
+// Copyright(c) 2024 Toby Corp.
+//------------------------------------------------------------------------
+
+#pragma once
+
+#include <complex>
+#include <valarray>
+
+namespace tobyCorp {
+namespace reference {
+
+typedef std::complex<float> Complex;
+typedef std::valarray<Complex> CArray;
+
+//------------------------------------------------------------------------
+//  Frozen copies of the fft/ifft/processFFT kernels as they were before
+//  any optimization. Do not optimize or "fix" anything in here: this is
+//  what the optimized SpectralEngine builds are measured against.
+//------------------------------------------------------------------------
+//  From https://rosettacode.org/wiki/Fast_Fourier_transform#C++
+void fft(CArray& x);
+void ifft(CArray& x);
+float wrapPhase(float phaseIn);
+
+//------------------------------------------------------------------------
+//  ReferenceVocoder
+//
+//  The frozen kernels in the plainest streaming frame possible: one frame
+//  every HopSize samples, processed and overlap-added right away, with
+//  the same window and gain as SpectralEngine. Latency is FFTSize.
+//------------------------------------------------------------------------
+class ReferenceVocoder
+{
+public:
+    static const int kMaxChannels = 2;
+
+    void prepare(int fftSize, int overlap, int numChannels);
+    void process(float** in, float** out, int numChannels, int numSamples, float pitchRatio);
+    int getLatencySamples() const { return FFTSize; }
+
+protected:
+    struct Channel
+    {
+        std::valarray<float> InFifo;   // rings indexed by Pos
+        std::valarray<float> OutAccum;
+        CArray Frame;
+
+        std::valarray<float> LastInputPhases;
+        std::valarray<float> LastOutputPhases;
+        std::valarray<float> AnalysisMag;
+        std::valarray<float> AnalysisFreq;
+        std::valarray<float> SynthMag;
+        std::valarray<float> SynthFreq;
+    };
+
+    void processFFT(CArray& x, Channel& c);
+
+    Channel Channels[kMaxChannels];
+    std::valarray<float> HWindow;
+    int FFTSize = 1024;
+    int HopSize = 256;
+    int NumChannels = 2;
+    float OutputGain = 1;
+    float fPitchRatio = 1;
+    int HopCounter = 0;
+    int Pos = 0;
+};
+
+//------------------------------------------------------------------------
+} // namespace reference
+} // namespace tobyCorp
@@ -0,0 +1,239 @@
+//------------------------------------------------------------------------
+// Copyright(c) 2024 Toby Corp.
+//------------------------------------------------------------------------
+
+#include "signalmetrics.h"
+#include "referencevocoder.h"
+#include <algorithm>
+#include <fstream>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace tobyCorp {
+namespace reference {
+
+static const int kLsdFrameSize = 1024;
+static const int kPitchFrameSize = 8192;   // 5.9Hz bins at 48kHz, a semitone at 100Hz
+static const float kPitchSearchSemitones = 2.f;
+static const float kLsdRange = 1e-3f;  // bins 60dB under the frame's or the signal's peak are clamped, so near silent
+                                       // bins and frames don't dominate
+
+//------------------------------------------------------------------------
+SignalMetrics compareSignals(const std::vector<float>& reference, const std::vector<float>& test)
+{
+    SignalMetrics m;
+    size_t length = std::min(reference.size(), test.size());
+
+    double signal = 0;
+    double error = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        float diff = test[i] - reference[i];
+        signal += (double)reference[i] * reference[i];
+        error += (double)diff * diff;
+        m.MaxError = std::max(m.MaxError, fabsf(diff));
+    }
+    m.SnrDb = error > 0 ? (float)(10.0 * log10(std::max(signal, 1e-30) / error)) : 300.f;
+
+    // a full scale sine peaks at a quarter of the frame size in a Hann windowed FFT
+    float signalPeak = 0;
+    for (size_t i = 0; i < length; i++)
+        signalPeak = std::max(signalPeak, fabsf(reference[i]));
+    float signalFloor = signalPeak * kLsdFrameSize / 4 * kLsdRange;
+
+    // Hann windowed frames with 50% overlap
+    CArray a(kLsdFrameSize);
+    CArray b(kLsdFrameSize);
+    double sum = 0;
+    int count = 0;
+    for (size_t start = 0; start + kLsdFrameSize <= length; start += kLsdFrameSize / 2)
+    {
+        for (int i = 0; i < kLsdFrameSize; i++)
+        {
+            float w = .5f * (1.f - cosf(2.f * M_PI * i / (float)kLsdFrameSize));
+            a[i] = reference[start + i] * w;
+            b[i] = test[start + i] * w;
+        }
+        fft(a);
+        fft(b);
+
+        float peak = 0;
+        for (int i = 0; i < kLsdFrameSize / 2; i++)
+            peak = std::max(peak, std::abs(a[i]));
+        float floor = std::max(peak * kLsdRange, signalFloor);
+        if (floor <= 0)
+            continue;
+
+        double frame = 0;
+        for (int i = 0; i < kLsdFrameSize / 2; i++)
+        {
+            float ra = std::max(std::abs(a[i]), floor);
+            float rb = std::max(std::abs(b[i]), floor);
+            float db = 20.f * log10f(rb / ra);
+            frame += db * db;
+        }
+        sum += sqrt(frame / (kLsdFrameSize / 2));
+        count++;
+    }
+    m.LogSpectralDb = count > 0 ? (float)(sum / count) : 0.f;
+    return m;
+}
+
+//------------------------------------------------------------------------
+float interChannelPhaseError(const std::vector<float>& inL, const std::vector<float>& inR,
+                             const std::vector<float>& outL, const std::vector<float>& outR, float pitchRatio)
+{
+    size_t length = std::min(std::min(inL.size(), inR.size()), std::min(outL.size(), outR.size()));
+
+    // the same frames as the log-spectral distance
+    CArray frames[4];
+    for (CArray& f : frames)
+        f.resize(kLsdFrameSize);
+    const std::vector<float>* signals[4] = {&inL, &inR, &outL, &outR};
+    double sum = 0;
+    double weights = 0;
+    for (size_t start = 0; start + kLsdFrameSize <= length; start += kLsdFrameSize / 2)
+    {
+        for (int s = 0; s < 4; s++)
+        {
+            for (int i = 0; i < kLsdFrameSize; i++)
+            {
+                float w = .5f * (1.f - cosf(2.f * M_PI * i / (float)kLsdFrameSize));
+                frames[s][i] = (*signals[s])[start + i] * w;
+            }
+            fft(frames[s]);
+        }
+
+        for (int i = 1; i < kLsdFrameSize / 2; i++)
+        {
+            int shifted = (int)floorf(i * pitchRatio + .5f);
+            if (shifted >= kLsdFrameSize / 2)
+                break;
+
+            Complex in = frames[0][i] * std::conj(frames[1][i]);
+            Complex out = frames[2][shifted] * std::conj(frames[3][shifted]);
+            float weight = std::abs(in);
+            sum += weight * fabsf(std::arg(out * std::conj(in)));
+            weights += weight;
+        }
+    }
+    return weights > 0 ? (float)(sum / weights) : 0.f;
+}
+
+//------------------------------------------------------------------------
+// power spectrum averaged over Hann frames with 50% overlap
+static std::vector<double> averagePower(const std::vector<float>& signal)
+{
+    std::vector<double> power(kPitchFrameSize / 2, 0.0);
+    CArray frame(kPitchFrameSize);
+    for (size_t start = 0; start + kPitchFrameSize <= signal.size(); start += kPitchFrameSize / 2)
+    {
+        for (int i = 0; i < kPitchFrameSize; i++)
+            frame[i] = signal[start + i] * .5f * (1.f - cosf(2.f * M_PI * i / (float)kPitchFrameSize));
+        fft(frame);
+        for (int i = 0; i < kPitchFrameSize / 2; i++)
+            power[i] += std::norm(frame[i]);
+    }
+    return power;
+}
+
+//------------------------------------------------------------------------
+// frequency in bins of the strongest peak between two bins, interpolated on a parabola through
+// the log power of the peak and its neighbours
+static float strongestPartial(const std::vector<double>& power, float lowBin, float highBin)
+{
+    int first = std::max((int)lowBin, 1);
+    int last = std::min((int)ceilf(highBin), (int)power.size() - 2);
+    if (first > last)
+        return 0.f;
+
+    int peak = (int)(std::max_element(power.begin() + first, power.begin() + last + 1) - power.begin());
+    double a = log(power[peak - 1] + 1e-30);
+    double b = log(power[peak] + 1e-30);
+    double c = log(power[peak + 1] + 1e-30);
+    double curve = a - 2.0 * b + c;
+    return (float)(peak + (curve < 0 ? .5 * (a - c) / curve : 0.0));
+}
+
+//------------------------------------------------------------------------
+float pitchErrorCents(const std::vector<float>& in, const std::vector<float>& out, float pitchRatio)
+{
+    // the strongest partial may be another harmonic after the shift, so the output is only
+    // searched around where the input's one should have gone
+    std::vector<double> inPower = averagePower(in);
+    float expected = strongestPartial(inPower, 1.f, (float)inPower.size()) * pitchRatio;
+    float range = powf(2.f, kPitchSearchSemitones / 12.f);
+    float measured = strongestPartial(averagePower(out), expected / range, expected * range);
+    if (expected <= 0 || measured <= 0)
+        return 1e9f;
+    return fabsf(1200.f * log2f(measured / expected));
+}
+
+//------------------------------------------------------------------------
+bool readWav(const std::string& path, std::vector<std::vector<float>>& channels, double& sampleRate)
+{
+    std::ifstream file(path, std::ios::binary);
+    char riff[12];
+    if (!file.read(riff, 12) || memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0)
+        return false;
+
+    uint16_t format = 0, numChannels = 0, bits = 0;
+    uint32_t rate = 0;
+    char id[4];
+    uint32_t size;
+    while (file.read(id, 4) && file.read((char*)&size, 4))
+    {
+        if (memcmp(id, "fmt ", 4) == 0)
+        {
+            std::vector<char> fmt(size);
+            file.read(fmt.data(), size);
+            memcpy(&format, &fmt[0], 2);
+            memcpy(&numChannels, &fmt[2], 2);
+            memcpy(&rate, &fmt[4], 4);
+            memcpy(&bits, &fmt[14], 2);
+            // WAVE_FORMAT_EXTENSIBLE keeps the real format in the sub format GUID
+            if (format == 0xfffe && size >= 26)
+                memcpy(&format, &fmt[24], 2);
+        }
+        else if (memcmp(id, "data", 4) == 0)
+        {
+            bool pcm16 = format == 1 && bits == 16;
+            bool float32 = format == 3 && bits == 32;
+            if (numChannels == 0 || (!pcm16 && !float32))
+                return false;
+
+            std::vector<char> data(size);
+            file.read(data.data(), size);
+            int frameBytes = numChannels * bits / 8;
+            size_t numFrames = size / frameBytes;
+            int numOut = std::min((int)numChannels, 2);
+
+            channels.assign(numOut, std::vector<float>(numFrames));
+            for (size_t i = 0; i < numFrames; i++)
+            {
+                for (int ch = 0; ch < numOut; ch++)
+                {
+                    const char* p = &data[i * frameBytes + ch * bits / 8];
+                    if (pcm16)
+                    {
+                        int16_t v;
+                        memcpy(&v, p, 2);
+                        channels[ch][i] = v / 32768.f;
+                    }
+                    else
+                        memcpy(&channels[ch][i], p, 4);
+                }
+            }
+            sampleRate = rate;
+            return true;
+        }
+        else
+            file.seekg(size + (size & 1), std::ios::cur);
+    }
+    return false;
+}
+
+//------------------------------------------------------------------------
+} // namespace reference
+} // namespace tobyCorp
@@ -0,0 +1,46 @@
+//------------------------------------------------------------------------
+// Copyright(c) 2024 Toby Corp.
+//------------------------------------------------------------------------
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace tobyCorp {
+namespace reference {
+
+//------------------------------------------------------------------------
+//  Distances between an engine's output and the reference output. Both
+//  signals must already be aligned for latency.
+//------------------------------------------------------------------------
+struct SignalMetrics
+{
+    float SnrDb = 0;            // reference power over error power
+    float LogSpectralDb = 0;    // RMS of the dB difference over bins and frames
+    float MaxError = 0;         // largest absolute sample difference
+};
+
+SignalMetrics compareSignals(const std::vector<float>& reference, const std::vector<float>& test);
+
+/** Mean error in radians of the phase between the channels: the phase of the output's
+    left/right cross-spectrum at each bin against the input's at the bin it was shifted from,
+    weighted by the input's cross-spectrum magnitude. The output must already be aligned to
+    the input for latency. */
+float interChannelPhaseError(const std::vector<float>& inL, const std::vector<float>& inR,
+                             const std::vector<float>& outL, const std::vector<float>& outR, float pitchRatio);
+
+/** Error in cents of the input's strongest partial, times the pitch ratio, against the
+    strongest partial of the output within two semitones of that. Both are read off the peak
+    of a long Hann spectrum averaged over the signal, so it only means something on signals
+    with steady partials. */
+float pitchErrorCents(const std::vector<float>& in, const std::vector<float>& out, float pitchRatio);
+
+//------------------------------------------------------------------------
+/** Reads a 16-bit PCM or 32-bit float WAV file, returns false when it
+    can't. Channels are returned separately, at most two. */
+bool readWav(const std::string& path, std::vector<std::vector<float>>& channels, double& sampleRate);
+
+//------------------------------------------------------------------------
+} // namespace reference
+} // namespace tobyCorp
@@ -0,0 +1,355 @@
+//------------------------------------------------------------------------
+// Copyright(c) 2024 Toby Corp.
+//------------------------------------------------------------------------
+
+#include "transitioncheck.h"
+#include "multiresengine.h"
+#include "spectralengine.h"
+#include "wsolaengine.h"
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+namespace tobyCorp {
+namespace reference {
+
+static const double kSampleRate = 48000;
+static const int kFFTSize = 1024;       // the processor's, its levels are derived from it
+static const float kMaxPitchRatio = 2.f;
+static const int kBlockSize = 64;
+static const int kFirstSwitch = 12000;  // from the full level to the one the checked switch starts on
+static const int kSwitch = 60000;
+static const int kSignalLength = 107520;  // whole blocks
+static const int kRmsSize = 128;        // a few periods of the lowest tone, short enough to show a hole
+static const int kRmsStep = 16;
+static const float kMaxDipDb = 6.f;     // under the lower of the steady levels before and after
+static const float kMaxBumpDb = 6.f;    // over the higher one
+
+//------------------------------------------------------------------------
+//  The processor's renderers and its governed switching between them,
+//  startTransition and renderGoverned without the corrector and the
+//  scratch buffers: every renderer is padded to the slowest level, the
+//  new one takes over the old one's phases, and either takes its frames
+//  from a frame centre on or is crossfaded with it.
+//------------------------------------------------------------------------
+class GovernedRenderers
+{
+public:
+    enum
+    {
+        kFull = 0,
+        kHalfOverlap,
+        kSmallFFT,
+        kTimeDomain,
+        kMultiRes,
+        kNumRenderers
+    };
+
+    void prepare(bool multiRes)
+    {
+        // the governor pads the multi-resolution engine's layout to its latency
+        Engine.prepare(kFFTSize, 4, 1, true);
+        ReducedEngines[0].prepare(kFFTSize, 2, 1, true);
+        ReducedEngines[1].prepare(kFFTSize / 2, 2, 1, true);
+        MultiRes.prepare(kSampleRate, 1, true);
+        Wsola.prepare(kSampleRate, 1, kMaxPitchRatio);
+        Latency = std::max(std::max(Engine.getLatencySamples(), Wsola.getLatencySamples()),
+                           std::max(ReducedEngines[0].getLatencySamples(), ReducedEngines[1].getLatencySamples()));
+        if (multiRes)
+            Latency = std::max(Latency, MultiRes.getLatencySamples());
+
+        Engine.prepare(kFFTSize, 4, 1, true, Latency);
+        ReducedEngines[0].prepare(kFFTSize, 2, 1, true, Latency);
+        ReducedEngines[1].prepare(kFFTSize / 2, 2, 1, true, Latency);
+        MultiRes.prepare(kSampleRate, 1, true, Latency);
+        Wsola.prepare(kSampleRate, 1, kMaxPitchRatio, Latency);
+        FullRenderer = multiRes ? kMultiRes : kFull;
+        ActiveRenderer = FullRenderer;
+        FadeFrom = -1;
+        FadeLength = (int)(0.02 * kSampleRate);
+    }
+
+    int getRenderer(int level) const { return level == 0 ? FullRenderer : level; }
+
+    void startTransition(int level)
+    {
+        int renderer = getRenderer(level);
+        int activeLevel = ActiveRenderer == FullRenderer ? 0 : ActiveRenderer;
+        FadeFrom = ActiveRenderer;
+        FadePos = 0;
+        if (renderer == kTimeDomain)
+        {
+            FadeHandover = false;
+            FadeDelay = 0;
+            Wsola.setFollowing(true);
+        }
+        else if (FadeFrom == kTimeDomain)
+        {
+            FadeHandover = false;
+            FadeDelay = -1;
+            takeOver(renderer, FadeFrom, 0);
+        }
+        else if (level < activeLevel)
+        {
+            FadeHandover = false;
+            FadeDelay = Latency + getHop(renderer);
+            takeOver(renderer, FadeFrom, 0);
+        }
+        else
+        {
+            FadeHandover = true;
+            takeOver(renderer, FadeFrom, Latency);
+            handOver(FadeFrom, renderer);
+        }
+        ActiveRenderer = renderer;
+    }
+
+    void process(float* in, float* out, int numSamples, float ratio)
+    {
+        float* pIn[1] = {in};
+        float* pOut[1] = {out};
+        std::vector<float> fadeOut(numSamples);
+        float* pFadeOut[1] = {fadeOut.data()};
+
+        int heard = ActiveRenderer;
+        int fading = FadeFrom;
+        for (int r = 0; r < kNumRenderers; r++)
+        {
+            if (r != heard && r != fading)
+                feed(r, pIn, numSamples);
+        }
+        if (heard == kTimeDomain && fading >= 0)
+        {
+            render(fading, pIn, pFadeOut, numSamples, ratio);
+            Wsola.follow(pFadeOut, 1, numSamples);
+            render(heard, pIn, pOut, numSamples, ratio);
+        }
+        else
+        {
+            render(heard, pIn, pOut, numSamples, ratio);
+            Wsola.follow(pOut, 1, numSamples);
+            if (fading == kTimeDomain && FadeDelay < 0 && FadePos >= Latency)
+            {
+                Wsola.setFollowing(true, true);
+                if (Wsola.isFollowing())
+                    FadeDelay = FadePos;
+            }
+            if (fading >= 0)
+                render(fading, pIn, pFadeOut, numSamples, ratio);
+        }
+
+        if (fading >= 0 && FadeHandover)
+        {
+            for (int i = 0; i < numSamples; i++)
+                out[i] += fadeOut[i];
+            FadePos += numSamples;
+            if (FadePos >= 2 * Latency)
+                FadeFrom = -1;
+        }
+        else if (fading >= 0)
+        {
+            bool equalPower = heard == kTimeDomain || fading == kTimeDomain;
+            for (int i = 0; i < numSamples; i++)
+            {
+                int t = FadeDelay < 0 ? 0 : FadePos + i - FadeDelay;
+                float x = t <= 0 ? 0.f : std::min((float)t / (float)FadeLength, 1.f);
+                float gain = equalPower ? sinf(0.5f * (float)M_PI * x) : x;
+                float fadeGain = equalPower ? cosf(0.5f * (float)M_PI * x) : 1.f - x;
+                out[i] = gain * out[i] + fadeGain * fadeOut[i];
+            }
+            FadePos += numSamples;
+            if (FadeDelay >= 0 && FadePos >= FadeDelay + FadeLength)
+            {
+                FadeFrom = -1;
+                Wsola.setFollowing(false);
+            }
+        }
+    }
+
+    bool isFading() const { return FadeFrom >= 0; }
+
+private:
+    void render(int renderer, float** in, float** out, int numSamples, float ratio)
+    {
+        switch (renderer)
+        {
+            case kFull: Engine.process(in, out, 1, numSamples, ratio); break;
+            case kHalfOverlap: ReducedEngines[0].process(in, out, 1, numSamples, ratio); break;
+            case kSmallFFT: ReducedEngines[1].process(in, out, 1, numSamples, ratio); break;
+            case kTimeDomain: Wsola.process(in, out, 1, numSamples, std::min(ratio, kMaxPitchRatio)); break;
+            case kMultiRes: MultiRes.process(in, out, 1, numSamples, ratio); break;
+        }
+    }
+
+    void feed(int renderer, float** in, int numSamples)
+    {
+        switch (renderer)
+        {
+            case kFull: Engine.feed(in, nullptr, 1, numSamples); break;
+            case kHalfOverlap: ReducedEngines[0].feed(in, nullptr, 1, numSamples); break;
+            case kSmallFFT: ReducedEngines[1].feed(in, nullptr, 1, numSamples); break;
+            case kTimeDomain: Wsola.feed(in, nullptr, 1, numSamples); break;
+            case kMultiRes: MultiRes.feed(in, nullptr, 1, numSamples); break;
+        }
+    }
+
+    int getHop(int renderer) const
+    {
+        switch (renderer)
+        {
+            case kFull: return kFFTSize / 4;
+            case kHalfOverlap: return kFFTSize / 2;
+            case kSmallFFT: return kFFTSize / 4;
+            case kMultiRes: return MultiResEngine::kLowFFTSize / MultiResEngine::kOverlap;
+        }
+        return 1;
+    }
+
+    int getSpectralEngines(int renderer, const SpectralEngine** engines) const
+    {
+        switch (renderer)
+        {
+            case kFull: engines[0] = &Engine; return 1;
+            case kHalfOverlap: engines[0] = &ReducedEngines[0]; return 1;
+            case kSmallFFT: engines[0] = &ReducedEngines[1]; return 1;
+            case kMultiRes:
+                engines[0] = MultiRes.getBand(0);
+                engines[1] = MultiRes.getBand(1);
+                return 2;
+        }
+        return 0;
+    }
+
+    void takeOver(int renderer, int from, int when)
+    {
+        const SpectralEngine* sources[2] = {};
+        int numSources = getSpectralEngines(from, sources);
+        switch (renderer)
+        {
+            case kFull: Engine.takeOver(sources, numSources, when); break;
+            case kHalfOverlap: ReducedEngines[0].takeOver(sources, numSources, when); break;
+            case kSmallFFT: ReducedEngines[1].takeOver(sources, numSources, when); break;
+            case kMultiRes: MultiRes.takeOver(sources, numSources, when); break;
+        }
+    }
+
+    void handOver(int renderer, int to)
+    {
+        const SpectralEngine* targets[2] = {};
+        int numTargets = getSpectralEngines(to, targets);
+        switch (renderer)
+        {
+            case kFull: Engine.handOver(targets, numTargets); break;
+            case kHalfOverlap: ReducedEngines[0].handOver(targets, numTargets); break;
+            case kSmallFFT: ReducedEngines[1].handOver(targets, numTargets); break;
+            case kMultiRes: MultiRes.handOver(targets, numTargets); break;
+        }
+    }
+
+    SpectralEngine Engine;
+    SpectralEngine ReducedEngines[2];
+    MultiResEngine MultiRes;
+    WsolaEngine Wsola;
+    int Latency = 0;
+    int FullRenderer = kFull;
+    int ActiveRenderer = kFull;
+    int FadeFrom = -1;
+    int FadePos = 0;
+    int FadeDelay = 0;
+    int FadeLength = 0;
+    bool FadeHandover = false;
+};
+
+//------------------------------------------------------------------------
+static float rmsDb(const std::vector<float>& x, int start)
+{
+    double sum = 0;
+    for (int i = start; i < start + kRmsSize; i++)
+        sum += (double)x[i] * x[i];
+    return (float)(10.0 * log10(sum / kRmsSize + 1e-20));
+}
+
+//------------------------------------------------------------------------
+int checkTransitions(bool verbose)
+{
+    static const char* kLevelNames[] = {"full", "half", "small", "wsola"};
+    static const float kTones[] = {220.f, 330.f, 440.f, 550.f, 660.f, 880.f, 1000.f};
+    const float ratio = powf(2.f, 0.3f);
+
+    printf("\n%-9s %-6s %-6s %6s %6s %10s %10s\n", "layout", "from", "to", "cases", "failed", "worst dip", "worst bump");
+    int failures = 0;
+    for (int multiRes = 0; multiRes < 2; multiRes++)
+    {
+        for (int from = 0; from < 4; from++)
+        {
+            for (int to = 0; to < 4; to++)
+            {
+                if (to == from)
+                    continue;
+                int cases = 0;
+                int failed = 0;
+                float worstDip = 0;
+                float worstBump = 0;
+                for (float tone : kTones)
+                {
+                    GovernedRenderers renderers;
+                    renderers.prepare(multiRes != 0);
+                    std::vector<float> in(kSignalLength);
+                    std::vector<float> out(kSignalLength);
+                    for (int i = 0; i < kSignalLength; i++)
+                        in[i] = 0.3f * sinf(2.f * (float)M_PI * tone * (float)i / (float)kSampleRate);
+                    for (int pos = 0; pos < kSignalLength; pos += kBlockSize)
+                    {
+                        // the governor switches between callbacks
+                        if (pos / kBlockSize == kFirstSwitch / kBlockSize && from != 0)
+                            renderers.startTransition(from);
+                        if (pos / kBlockSize == kSwitch / kBlockSize)
+                            renderers.startTransition(to);
+                        renderers.process(&in[pos], &out[pos], kBlockSize, ratio);
+                    }
+
+                    // steady before, after both fades, and the switch with a frame's margin
+                    float low = 1e9f;
+                    float high = -1e9f;
+                    for (int a = kSwitch - 24000; a < kSwitch - 1024; a += kRmsStep)
+                    {
+                        low = std::min(low, rmsDb(out, a));
+                        high = std::max(high, rmsDb(out, a));
+                    }
+                    for (int a = kSwitch + 19000; a + kRmsSize <= kSignalLength; a += kRmsStep)
+                    {
+                        low = std::min(low, rmsDb(out, a));
+                        high = std::max(high, rmsDb(out, a));
+                    }
+                    float dip = 0;
+                    float bump = 0;
+                    for (int a = kSwitch - 1024; a < kSwitch + 19000; a += kRmsStep)
+                    {
+                        dip = std::min(dip, rmsDb(out, a) - low);
+                        bump = std::max(bump, rmsDb(out, a) - high);
+                    }
+                    bool pass = dip >= -kMaxDipDb && bump <= kMaxBumpDb && !renderers.isFading();
+                    cases++;
+                    failed += pass ? 0 : 1;
+                    worstDip = std::min(worstDip, dip);
+                    worstBump = std::max(worstBump, bump);
+                    if (verbose || !pass)
+                    {
+                        printf("%-4s %-9s %-6s %-6s tone %4.0fHz: dip %5.1fdB bump %4.1fdB%s\n", pass ? "ok" : "FAIL",
+                            multiRes ? "multi-res" : "spectral", kLevelNames[from], kLevelNames[to], tone, dip, bump,
+                            renderers.isFading() ? " still fading" : "");
+                    }
+                }
+                printf("%-9s %-6s %-6s %6d %6d %8.1fdB %8.1fdB\n", multiRes ? "multi-res" : "spectral",
+                    kLevelNames[from], kLevelNames[to], cases, failed, worstDip, worstBump);
+                failures += failed;
+            }
+        }
+    }
+    return failures;
+}
+
+//------------------------------------------------------------------------
+} // namespace reference
+} // namespace tobyCorp
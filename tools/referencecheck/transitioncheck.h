@@ -0,0 +1,20 @@
+//------------------------------------------------------------------------
+// Copyright(c) 2024 Toby Corp.
+//------------------------------------------------------------------------
+
+#pragma once
+
+namespace tobyCorp {
+namespace reference {
+
+//------------------------------------------------------------------------
+/** Switches between the renderers the CPU governor steps through, on steady tones, the way
+    the processor switches them: the spectral engines hand their frames over or are crossfaded
+    with the phases taken over, WSOLA follows the renderer it is crossfaded with. Prints the
+    worst dip of each switch under the lower steady level of the two renderers, and returns
+    how many switches dip further than allowed. */
+int checkTransitions(bool verbose);
+
+//------------------------------------------------------------------------
+} // namespace reference
+} // namespace tobyCorp